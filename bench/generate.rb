@@ -0,0 +1,231 @@
+#!/usr/bin/env ruby
+# Generates a reproducible synthetic C/C++ code base for benchmarking csope.
+#
+#  Usage: bench/generate.rb [-n files] [-s seed] [-o directory]
+#
+# The same seed and file count always yield byte identical trees.
+# Identifiers are drawn from a Zipf distribution,
+#  so a handful of names are everywhere while the long tail is rare,
+#  much like in real projects.
+# Every source file includes its own module header
+#  and a Zipf chosen fan-out of other module headers;
+#  roughly one file in a thousand is a very long generated table.
+# Alongside the tree, "cscope.files" lists every generated file
+#  and "manifest.json" records the parameters and query terms
+#  for bench/run.rb.
+
+require 'optparse'
+require 'fileutils'
+require 'json'
+
+$options = { files: 1000, seed: 1, output: "bench_tree" }
+OptionParser.new do |o|
+  o.banner = "Usage: #{$0} [-n files] [-s seed] [-o directory]"
+  o.on("-n", "--files N", Integer, "number of files to generate (default 1000)") { |v| $options[:files] = v }
+  o.on("-s", "--seed N", Integer, "random seed (default 1)") { |v| $options[:seed] = v }
+  o.on("-o", "--output DIR", "output directory (default bench_tree)") { |v| $options[:output] = v }
+end.parse!
+
+MODULE_FILES   = 64       # source files per module directory
+MODULE_EXPORTS = 32       # functions declared by every module header
+MAX_FANOUT     = 12       # most foreign headers a single file includes
+LONG_EVERY     = 1000     # one file in this many is a long table
+LONG_LINES     = 20000    # lines in such a long file
+CPP_EVERY      = 5        # one file in this many is C++
+
+SYLLABLES = %w[ba be bi bo bu ca ce ci co cu da de di do du fa fe fi fo fu
+               ga ge gi go gu ha he hi ho hu ka ke ki ko ku la le li lo lu
+               ma me mi mo mu na ne ni no nu pa pe pi po pu ra re ri ro ru
+               sa se si so su ta te ti to tu va ve vi vo vu za ze zi zo zu]
+KEYWORDS = %w[auto break case char const continue default do double else enum
+              extern float for goto if int long register return short signed
+              sizeof static struct switch typedef union unsigned void volatile
+              while new delete class namespace public private this true false]
+
+# Zipf sampler over 0...n with exponent s, by inverse transform on the CDF
+class Zipf
+  def initialize(n, s, random)
+    @random = random
+    total   = 0.0
+    @cdf    = Array.new(n) { |k| total += 1.0 / ((k + 1) ** s) }
+    @cdf.map! { |c| c / total }
+  end
+
+  def next
+    r = @random.rand
+    @cdf.bsearch_index { |c| c >= r } || @cdf.size - 1
+  end
+end
+
+$random   = Random.new($options[:seed])
+nfiles    = [$options[:files], 1].max
+nmodules  = (nfiles + MODULE_FILES - 1) / MODULE_FILES
+vocabsize = [(Math.sqrt(nfiles) * 64).to_i, 512].max
+
+# deterministic vocabulary of 2-4 syllable words
+$vocabulary = []
+seen = {}
+while $vocabulary.size < vocabsize
+  word = Array.new(2 + $random.rand(3)) { SYLLABLES[$random.rand(SYLLABLES.size)] }.join
+  next if seen[word] || KEYWORDS.include?(word)
+  seen[word] = true
+  $vocabulary << word
+end
+
+$words   = Zipf.new(vocabsize, 1.1, $random)
+$modules = Zipf.new(nmodules, 1.0, $random)
+
+def word
+  $vocabulary[$words.next]
+end
+
+def module_name(m)
+  format("mod%04d", m)
+end
+
+# the exported function names are a pure function of the module index,
+#  so every file can call into any module without shared state
+def export_name(m, i)
+  "#{module_name(m)}_#{$vocabulary[(m * 7919 + i * 104729) % $vocabulary.size]}_#{i}"
+end
+
+def count_name(m)
+  "#{module_name(m)}_count"
+end
+
+def module_dir(m)
+  # keep directories small, as real trees do
+  File.join(format("d%02d", m / 256), module_name(m))
+end
+
+def header_path(m)
+  File.join(module_dir(m), module_name(m) + ".h")
+end
+
+def write_header(root, m)
+  guard = module_name(m).upcase + "_H"
+  File.open(File.join(root, header_path(m)), "w") do |f|
+    f.puts "#ifndef #{guard}", "#define #{guard}", ""
+    f.puts "#include <stddef.h>", ""
+    f.puts "#define #{guard}_#{word.upcase} #{$random.rand(1000)}", ""
+    f.puts "typedef struct #{module_name(m)}_state {"
+    4.times { |i| f.puts "\tlong #{word}_#{i};" }
+    f.puts "\tstruct #{module_name(m)}_state *next;"
+    f.puts "} #{module_name(m)}_state_t;", ""
+    f.puts "extern int #{count_name(m)};", ""
+    MODULE_EXPORTS.times { |i| f.puts "long #{export_name(m, i)}(long #{word}, long #{word}_b);" }
+    f.puts "", "#endif /* #{guard} */"
+  end
+end
+
+def write_function(f, name, m, exported)
+  a, b = word, word + "_b"
+  f.puts "/* #{word} #{word} #{word} */"
+  f.puts "#{exported ? "" : "static "}long #{name}(long #{a}, long #{b}) {"
+  f.puts "\tlong #{word}_v = #{a} + #{b};"
+  (3 + $random.rand(10)).times do |i|
+    callee = $modules.next
+    case $random.rand(6)
+    when 0
+      f.puts "\tif (#{a} > #{$random.rand(100)}) { #{b} = #{export_name(callee, $random.rand(MODULE_EXPORTS))}(#{a}, #{b}); }"
+    when 1
+      f.puts "\tfor (long i = 0; i < #{b}; ++i) { #{a} += i * #{$random.rand(17)}; }"
+    when 2
+      f.puts "\tprintf(\"#{word} #{word} %ld\\n\", #{a});"
+    when 3
+      f.puts "\t#{count_name(m)} = (int) #{a};"
+    else
+      f.puts "\t#{b} ^= #{export_name(callee, $random.rand(MODULE_EXPORTS))}(#{b}, #{i});"
+    end
+  end
+  f.puts "\treturn #{a} + #{b};", "}", ""
+end
+
+def write_source(root, path, m, index, count, fanout)
+  File.open(File.join(root, path), "w") do |f|
+    f.puts "/* generated #{word} #{word} */", ""
+    f.puts "#include <stdio.h>"
+    f.puts "#include \"#{header_path(m)}\""
+    fanout.each { |o| f.puts "#include \"#{header_path(o)}\"" }
+    f.puts ""
+    f.puts "int #{count_name(m)};", "" if index == 0
+    if path.end_with?(".cpp")
+      f.puts "namespace #{module_name(m)}_ns {", ""
+      f.puts "class #{word.capitalize}#{index} {", "public:"
+      f.puts "\tlong #{word}(long x) { return x + #{$random.rand(100)}; }"
+      f.puts "private:", "\tlong #{word}_m;", "};", ""
+      f.puts "}", ""
+    end
+    (1 + $random.rand(4)).times { |i| write_function(f, "#{module_name(m)}_#{word}_s#{index}_#{i}", m, false) }
+    # spread the exports of the module across its files
+    index.step(MODULE_EXPORTS - 1, count) { |i| write_function(f, export_name(m, i), m, true) }
+  end
+end
+
+def write_long(root, path, m)
+  File.open(File.join(root, path), "w") do |f|
+    f.puts "/* generated table */", ""
+    f.puts "#include \"#{header_path(m)}\"", ""
+    f.puts "const long #{module_name(m)}_#{word}_table[] = {"
+    LONG_LINES.times { |i| f.puts "\t#{$random.rand(1 << 30)}, /* #{word} #{i} */" }
+    f.puts "};"
+  end
+end
+
+root = $options[:output]
+FileUtils.rm_rf(root)
+FileUtils.mkdir_p(root)
+
+files = []
+longs = 0
+nmodules.times do |m|
+  FileUtils.mkdir_p(File.join(root, module_dir(m)))
+  write_header(root, m)
+  files << header_path(m)
+
+  count = [MODULE_FILES, nfiles - m * MODULE_FILES].min
+  count.times do |i|
+    n    = m * MODULE_FILES + i
+    ext  = (n % CPP_EVERY == CPP_EVERY - 1) ? ".cpp" : ".c"
+    path = File.join(module_dir(m), format("%s_%02d%s", module_name(m), i, ext))
+    if n % LONG_EVERY == LONG_EVERY / 2
+      write_long(root, path, m)
+      longs += 1
+    else
+      fanout = Array.new($random.rand(MAX_FANOUT + 1)) { $modules.next }.uniq - [m]
+      write_source(root, path, m, i, count, fanout)
+    end
+    files << path
+  end
+end
+
+File.write(File.join(root, "cscope.files"), files.join("\n") + "\n")
+
+# query terms of known popularity for every line mode field
+hot    = $vocabulary[0]
+cold   = $vocabulary[vocabsize - 1]
+called = export_name(0, 0)
+caller = export_name(nmodules - 1, 0)
+manifest = {
+  files: files.size,
+  sources: nfiles,
+  modules: nmodules,
+  long_files: longs,
+  seed: $options[:seed],
+  vocabulary: vocabsize,
+  queries: {
+    "0" => [hot, cold],
+    "1" => [called, caller],
+    "2" => [caller],
+    "3" => [called],
+    "4" => ["#{hot} #{hot}", cold],
+    "5" => [hot],
+    "6" => ["#{hot}_[0-9]", "^long mod00[0-9]*_"],
+    "7" => [module_name(0), "_00.c"],
+    "8" => [File.basename(header_path(0))],
+    "9" => [count_name(0), "#{hot}_b"]
+  }
+}
+File.write(File.join(root, "manifest.json"), JSON.pretty_generate(manifest) + "\n")
+
+puts "#{files.size} files (#{nmodules} modules, #{longs} long) written to #{root}"
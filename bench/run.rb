@@ -0,0 +1,170 @@
+#!/usr/bin/env ruby
+# Times csope over a tree made by bench/generate.rb and reports JSON.
+#
+#  Usage: bench/run.rb [-c csope] [-t tree] [-r repeats] [-o output]
+#
+# Measured, in this order:
+#  + full build of a fresh database
+#  + rebuild with nothing changed
+#  + incremental rebuild after touching one percent of the sources,
+#     which are restored afterwards
+#  + full build of an inverted index (-q) database
+#  + every line mode query field (-L -0 ... -L -9),
+#     against both databases, for the terms in the manifest
+# Each measurement is repeated and reported as all samples plus
+#  the minimum and median, so results of different commits
+#  can be compared with any JSON tool.
+# If the binary supports --build-stats, its per phase report
+#  is attached to every build measurement.
+
+require 'optparse'
+require 'json'
+require 'open3'
+require 'time'
+
+$options = { csope: "csope", tree: "bench_tree", repeats: 3, output: nil }
+OptionParser.new do |o|
+  o.banner = "Usage: #{$0} [-c csope] [-t tree] [-r repeats] [-o output]"
+  o.on("-c", "--csope PATH", "binary to measure (default csope from PATH)") { |v| $options[:csope] = v }
+  o.on("-t", "--tree DIR", "tree made by bench/generate.rb (default bench_tree)") { |v| $options[:tree] = v }
+  o.on("-r", "--repeats N", Integer, "runs per measurement (default 3)") { |v| $options[:repeats] = v }
+  o.on("-o", "--output FILE", "write the JSON here instead of stdout") { |v| $options[:output] = v }
+end.parse!
+
+csope = $options[:csope]
+csope = File.expand_path(csope) if csope.include?("/")
+tree  = $options[:tree]
+abort "#{tree}/manifest.json not found; run bench/generate.rb first" unless File.exist?(File.join(tree, "manifest.json"))
+manifest = JSON.parse(File.read(File.join(tree, "manifest.json")))
+sources  = File.readlines(File.join(tree, "cscope.files"), chomp: true)
+
+DATABASE  = "bench.out"
+INVERTED  = "bench_q.out"
+help      = Open3.capture2e(csope, "-h")[0] rescue abort("cannot run #{csope}")
+$stats    = help.include?("--build-stats")
+
+# run csope once inside the tree, returning wall and child cpu seconds,
+#  the number of output lines and the --build-stats report, if any
+def measure(tree, argv)
+  before = Process.times
+  start  = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  out, err, status = Open3.capture3(*argv, chdir: tree, stdin_data: "")
+  wall  = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+  after = Process.times
+  abort "#{argv.join(" ")} failed:\n#{err}" unless status.success?
+  report = err.lines.reverse.find { |l| l.start_with?("{") }
+  {
+    wall: wall.round(6),
+    cpu: (after.cutime + after.cstime - before.cutime - before.cstime).round(6),
+    lines: out.lines.size,
+    stats: report && (JSON.parse(report) rescue nil)
+  }
+end
+
+# repeat a measurement, with an optional preparation step before each run
+def series(repeats, tree, argv, &prepare)
+  samples = Array.new(repeats) do
+    prepare&.call
+    measure(tree, argv)
+  end
+  walls = samples.map { |s| s[:wall] }.sort
+  {
+    command: argv.drop(1).join(" "),
+    wall_min: walls.first,
+    wall_median: walls[walls.size / 2],
+    cpu_median: samples.map { |s| s[:cpu] }.sort[samples.size / 2],
+    lines: samples.last[:lines],
+    samples: samples.map { |s| s.compact }
+  }
+end
+
+def remove_databases(tree)
+  Dir.glob(File.join(tree, "bench*.out*")).each { |f| File.delete(f) }
+end
+
+build = [csope, "-k", "-b", "-i", "cscope.files", "-f", DATABASE]
+build << "--build-stats" if $stats
+inverted = [csope, "-k", "-b", "-q", "-i", "cscope.files", "-f", INVERTED]
+inverted << "--build-stats" if $stats
+
+repeats = [$options[:repeats], 1].max
+results = { builds: {}, queries: {} }
+
+$stderr.puts "full build"
+results[:builds][:full] = series(repeats, tree, build) { remove_databases(tree) }
+$stderr.puts "unchanged rebuild"
+results[:builds][:unchanged] = series(repeats, tree, build)
+
+# append to every hundredth source, so the touched set is stable;
+#  the touched files are dated past the database, as a build only
+#  cross-references the files modified after it
+touched = sources.each_with_index.select { |_, i| i % 100 == 50 }.map(&:first)
+touched = [sources.last] if touched.empty?
+# and put them back afterwards, so the tree stays the one generated
+saved = touched.to_h do |f|
+  path = File.join(tree, f)
+  [path, [File.binread(path), File.atime(path), File.mtime(path)]]
+end
+generation = 0
+$stderr.puts "incremental rebuild (#{touched.size} files)"
+begin
+  results[:builds][:incremental] = series(repeats, tree, build) do
+    generation += 1
+    later = File.mtime(File.join(tree, DATABASE)) + 1
+    touched.each do |f|
+      path = File.join(tree, f)
+      File.open(path, "a") { |io| io.puts "int bench_touched_#{generation};" }
+      File.utime(later, later, path)
+    end
+  end
+ensure
+  saved.each do |path, (contents, atime, mtime)|
+    File.binwrite(path, contents)
+    File.utime(atime, mtime, path)
+  end
+end
+results[:builds][:incremental][:touched] = touched.size
+# the queries are run against a database of the restored tree
+remove_databases(tree)
+measure(tree, build)
+if $stats
+  results[:builds][:incremental][:samples].each do |s|
+    abort "incremental rebuild cross-referenced no files" if s.dig(:stats, "lexed") == 0
+  end
+end
+
+$stderr.puts "inverted index build"
+results[:builds][:inverted] = series(repeats, tree, inverted) do
+  Dir.glob(File.join(tree, INVERTED + "*")).each { |f| File.delete(f) }
+end
+
+results[:database_bytes] = Dir.glob(File.join(tree, "bench*.out*")).sort.to_h { |f| [File.basename(f), File.size(f)] }
+
+manifest["queries"].each do |field, terms|
+  $stderr.puts "query field #{field}"
+  results[:queries][field] = terms.flat_map do |term|
+    [[DATABASE, []], [INVERTED, ["-q"]]].map do |db, flags|
+      query = [csope, "-k", "-d", *flags, "-f", db, "-L", "-#{field}", term]
+      series(repeats, tree, query).merge(term: term, database: db)
+    end
+  end
+end
+
+commit = Dir.chdir(__dir__) { `git rev-parse HEAD 2>/dev/null`.strip }
+report = {
+  commit: commit.empty? ? nil : commit,
+  date: Time.now.utc.iso8601,
+  csope: csope,
+  host: { nproc: `nproc 2>/dev/null`.strip.to_i, uname: `uname -srm`.strip },
+  repeats: repeats,
+  build_stats: $stats,
+  tree: manifest.reject { |k, _| k == "queries" },
+  **results
+}
+
+json = JSON.pretty_generate(report) + "\n"
+if $options[:output]
+  File.write($options[:output], json)
+else
+  print json
+end
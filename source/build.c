@@ -37,21 +37,31 @@
  */
 
 #include "build.h"
+#include "buildstats.h"
+#include "digraph.h"
 
 #include "global.h" /* FIXME: get rid of this! */
 
 #include "library.h"
+#include "postsort.h"
 
 #include "scanner.h"
 #include "version.inc"
 #include "vpath.h"
+#include "watch.h"
 
 # include <ncurses.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 /* Exported variables: */
 bool buildonly	   = false; /* only build the database */
 bool unconditional = false; /* unconditionally build database */
 bool fileschanged;			/* assume some files changed */
+int	 buildjobs = 1;			/* parallel cross-reference jobs */
 
 /* variable copies of the master strings... */
 char  invname_buf[] = INVNAME;
@@ -62,14 +72,13 @@ char *invpost		= invpost_buf; /* inverted index postings */
 char *reffile		= reffile_buf; /* cross-reference file path name */
 
 char *newreffile;				   /* new cross-reference file name */
-FILE *newrefs;					   /* new cross-reference */
-FILE *postings;					   /* new inverted index postings */
 int	  symrefs = -1;				   /* cross-reference file */
 
 INVCONTROL invcontrol;			   /* inverted file control structure */
 
 char temp1[PATHLEN + 1];		/* temporary file name */
 char temp2[PATHLEN + 1];		/* temporary file name */
+static char tempdirpv[PATHLEN + 1];	/* private temp directory */
 
 
 /* Local variables: */
@@ -77,6 +86,45 @@ static char *newinvname;	/* new inverted index file name */
 static char *newinvpost;	/* new inverted index postings file name */
 static long	 traileroffset; /* file trailer offset */
 
+/* old inverted index postings reused for the files that are copied */
+#define NOREUSE LONG_MIN /* old file not copied */
+static bool		  reusepostings;  /* reusing the old postings */
+static bool		  reusefailed;	  /* a copied file's offsets did not map */
+static bool		  noreuse;		  /* make all the postings again */
+static INVCONTROL oldinvcontrol;  /* old inverted index */
+static long		 *reusedelta;	  /* database offset change by old file number */
+static long		  nreusedelta;
+static long		  oldfilenumber;  /* number of the file from getoldfile() */
+static long		  oldfileoffset;  /* and its old database offset */
+static char		  oldterm[TERMMAX]; /* old index term being reused */
+static POSTING	 *oldpostings;	  /* and its postings */
+static long		  noldpostings;
+static long		  moldpostings;
+static long		  nextoldposting;
+
+/* source file contents, for change detection */
+typedef struct {
+	char			  *name;
+	unsigned long long hash; /* FNV-1a of the contents */
+	long			   size; /* -1 if unknown */
+} filehash_t;
+
+static filehash_t	*oldhashes;	 /* old database's files, by name */
+static unsigned long noldhashes;
+static filehash_t	*srchashes;	 /* source files' contents, by file index */
+static unsigned long nsrchashes;
+
+/* cross-reference reader state, put aside while a job file is read */
+typedef struct {
+	int	  symrefs;
+	long  blocknumber;
+	long  blocklen;
+	char  blockmark;
+	char *blockp;
+	char *block;
+	char  blockbuf[BUFSIZ + 2];
+} blockstate_t;
+
 
 /* Internal prototypes: */
 static void	 cannotindex(void);
@@ -89,6 +137,23 @@ static void	 putheader(char *dir);
 static void	 fetch_include_from_dbase(char *, size_t);
 static void	 putlist(char **names, int count);
 static bool	 samelist(FILE *oldrefs, char **names, int count);
+static bool *start_jobs(unsigned long firstfile, unsigned long lastfile, const struct timespec *reftime);
+static bool	 newer(const char *file, const struct stat *file_status, const struct timespec *reftime);
+static void	 run_job(const unsigned long *todo, unsigned long ntodo, int job, int jobs);
+static void	 putjobheader(double seconds);
+static void	 job_file_name(char *path, size_t size, unsigned long fileindex);
+static bool	 copy_job_file(unsigned long fileindex, filehash_t *h, double *seconds);
+static void	 crossref_file(bool *jobdone, unsigned long firstfile, unsigned long fileindex);
+static bool	 hashfile(const char *file, filehash_t *h);
+static void	 read_old_hashes(FILE *oldrefs);
+static filehash_t *srchash(unsigned long fileindex);
+static bool	 content_changed(unsigned long fileindex, const struct stat *file_status);
+static void	 puthashes(void);
+static void	 free_hashes(void);
+static void	 start_reuse(void);
+static void	 copyreused(void);
+static void	 end_reuse(void);
+static const TERMPOSTING *getoldposting(void);
 
 /* Error handling routine if inverted index creation fails */
 static void cannotindex(void) {
@@ -140,11 +205,12 @@ void setup_build_filenames(const char * const reffile) {
 
 /* open the database */
 void opendatabase(const char * const reffile) {
-	if((symrefs = vpopen(reffile, O_BINARY | O_RDONLY)) == -1) {
+	if((symrefs = dbzopen(reffile)) == -1) {
 		cannotopen(reffile);
 		myexit(1);
 	}
 	blocknumber = -1; /* force next seek to read the first block */
+	dbmap();
 
 	/* open any inverted index */
 	if (invertedindex == true
@@ -156,7 +222,8 @@ void opendatabase(const char * const reffile) {
 
 /* rebuild the database */
 void rebuild(void) {
-	close(symrefs);
+	dbunmap();
+	dbzclose(symrefs);
 	if(invertedindex == true) {
 		invclose(&invcontrol);
 		nsrcoffset = 0;
@@ -176,7 +243,7 @@ void rebuild(void) {
 void build(void) {
 	unsigned long i;
 	FILE		 *oldrefs;				/* old cross-reference file */
-	time_t		  reftime;				/* old crossref modification time */
+	struct timespec reftime;			/* old crossref modification time */
 	char		 *file;					/* current file */
 	char		 *oldfile;				/* file in old cross-reference */
 	char		  newdir[PATHLEN + 1];	/* directory in new cross-reference */
@@ -190,6 +257,8 @@ void build(void) {
 	int			  copied = 0;			/* copied crossref for these files */
 	unsigned long fileindex;			/* source file name index */
 	bool		  interactive = true;	/* output progress messages */
+	bool		  reformat	  = false;	/* the old database is in the other format */
+	stattime_t	  start;				/* start of a timed phase */
 
     // XXX: find a safe way to remove this,
     //       building is cheap, $HOME moves rarely
@@ -204,15 +273,19 @@ void build(void) {
 	/* sort the source file names (needed for rebuilding) */
 	qsort(srcfiles, nsrcfiles, sizeof(*srcfiles), qsort_compare);
 
+	/* #include files may have come or gone since the last build */
+	free_inccache();
+
 	/* if there is an old cross-reference and its current directory matches */
 	/* or this is an unconditional build */
-	if((oldrefs = vpfopen(reffile, "rb")) != NULL
+	if((oldrefs = dbzfopen(reffile)) != NULL
     && !unconditional
     && fscanf(oldrefs, PROGRAM_NAME " %d %" PATHLEN_STR "s", &fileversion, olddir) == 2
     && (strcmp(olddir, currentdir) == 0 /* remain compatible */ || strcmp(olddir, newdir) == 0)) {
 		/* get the cross-reference file's modification time */
-		fstat(fileno(oldrefs), &file_status);
-		reftime = file_status.st_mtime;
+		dbzfstat(oldrefs, &file_status);
+		reftime = file_status.st_mtim;
+		defaultdigraphs();
 		if(fileversion >= 8) {
 			bool oldcompress	  = true;
 			bool oldinvertedindex = false;
@@ -236,6 +309,12 @@ void build(void) {
 					case 'T': /* truncate symbols to 8 characters */
 						oldtruncate = true;
 						break;
+					case 'D': /* digraph table */
+						if(readdigraphs(oldrefs) == false) {
+							posterr(PROGRAM_NAME ": incorrect symbol database file format\n");
+							goto force;
+						}
+						break;
 				}
 			}
 			/* check the old and new option settings */
@@ -254,15 +333,21 @@ void build(void) {
 				}
 				goto outofdate;
 			}
+			/* a database in the other format is copied into the requested one */
+			reformat = dbzcompressed(oldrefs) != blockcompress;
 			/* seek to the trailer */
 			if(fscanf(oldrefs, "%ld", &traileroffset) != 1 ||
 				fseek(oldrefs, traileroffset, SEEK_SET) == -1) {
 				posterr(PROGRAM_NAME ": incorrect symbol database file format\n");
 				goto force;
 			}
+			read_old_hashes(oldrefs);
 		}
+		/* old text is copied, so it keeps the old digraph table */
+		initcompress();
+
 		/* if assuming that some files have changed */
-		if(fileschanged == true) { goto outofdate; }
+		if(fileschanged == true || reformat == true) { goto outofdate; }
 		/* see if the directory lists are the same */
 		if(samelist(oldrefs, srcdirs, nsrcdirs) == false ||
 			samelist(oldrefs, incdirs, nincdirs) == false
@@ -278,7 +363,7 @@ void build(void) {
 			if((1 != fscanf(oldrefs, " %[^\n]", oldname)) ||
 				strnotequal(oldname, srcfiles[i]) ||
 				(lstat(srcfiles[i], &file_status) != 0) ||
-				(file_status.st_mtime > reftime)) {
+				(newer(srcfiles[i], &file_status, &reftime) && content_changed(i, &file_status))) {
 				goto outofdate;
 			}
 		}
@@ -288,6 +373,8 @@ void build(void) {
 			addsrcfile(oldname);
 		}
 		fclose(oldrefs);
+		free_hashes();
+		stats_report();
 		return;
 
 	outofdate:
@@ -298,7 +385,7 @@ void build(void) {
 			goto force;
 		}
 		/* reopen the old cross-reference file for fast scanning */
-		if((symrefs = vpopen(reffile, O_BINARY | O_RDONLY)) == -1) {
+		if((symrefs = dbzopen(reffile)) == -1) {
 			postfatal(PROGRAM_NAME ": cannot open file %s\n", reffile);
 			/* NOTREACHED */
 		}
@@ -306,20 +393,29 @@ void build(void) {
 		blocknumber = -1;
 		read_crossreference_block();	/* read the first cross-ref block */
 		scanpast('\t'); /* skip the header */
-		oldfile = getoldfile();
+		oldfilenumber = -1;
+		oldfile		  = getoldfile();
+		if(invertedindex == true && noreuse == false) { start_reuse(); }
 	} else {			/* force cross-referencing of all the source files */
 	force:
-		reftime = 0;
-		oldfile = NULL;
+		reftime.tv_sec	= 0;
+		reftime.tv_nsec = 0;
+		oldfile			= NULL;
+
+		/* choose the digraph table for these source files */
+		traindigraphs();
+		initcompress();
 	}
 	/* open the new cross-reference file */
-	if((newrefs = myfopen(newreffile, "wb")) == NULL) {
+	if(dbcreate(newreffile) == false) {
 		postfatal(PROGRAM_NAME ": cannot open file %s\n", reffile);
 		/* NOTREACHED */
 	}
-	if(invertedindex == true && (postings = myfopen(temp1, "wb")) == NULL) {
-		cannotwrite(temp1);
-		cannotindex();
+	if(invertedindex == true) {
+		char runprefix[PATHLEN + 1];
+
+		snprintf(runprefix, sizeof(runprefix), "%s/" PROGRAM_NAME ".s", tempdirpv);
+		if(postsort_open(runprefix, buildjobs) == false) { cannotindex(); }
 	}
 	putheader(newdir);
 	fileversion = FILEVERSION;
@@ -339,8 +435,13 @@ void build(void) {
 		srcoffset = malloc((nsrcfiles + 1u) * sizeof(*srcoffset));
 	}
 	for(;;) {
+		bool *jobdone;	/* files lexed ahead by build jobs */
+
 		progress("Building symbol database", (long)built, (long)lastfile);
 		if(linemode == false) refresh();
+		stats_begin(&start);
+		jobdone = start_jobs(firstfile, lastfile, &reftime);
+		stats_end(PHASE_CROSSREF, &start);
 
 		/* get the next source file name */
 		for(fileindex = firstfile; fileindex < lastfile; ++fileindex) {
@@ -356,11 +457,12 @@ void build(void) {
 			}
 			/* if there isn't an old database or this is a new file */
 			if(oldfile == NULL || strcmp(file, oldfile) < 0) {
-				crossref(file);
+				crossref_file(jobdone, firstfile, fileindex);
 				++built;
-			} else if(lstat(file, &file_status) == 0 && file_status.st_mtime > reftime) {
+			} else if(lstat(file, &file_status) == 0 && newer(file, &file_status, &reftime)
+				&& content_changed(fileindex, &file_status)) {
 				/* if this file was modified */
-				crossref(file);
+				crossref_file(jobdone, firstfile, fileindex);
 				++built;
 
 				/* skip its old crossref so modifying the last source
@@ -370,17 +472,24 @@ void build(void) {
 				 * this is less likely */
 				oldfile = getoldfile();
 			} else {
+				long offset = dboffset;
+
 				/* copy its cross-reference */
+				stats_begin(&start);
 				putfilename(file);
-				if(invertedindex == true) {
+				if(reusepostings == true) {
+					copyreused();
+				} else if(invertedindex == true) {
 					copyinverted();
 				} else {
 					copydata();
 				}
+				stats_copied(dboffset - offset, &start);
 				++copied;
 				oldfile = getoldfile();
 			}
 		}
+		free(jobdone);
 		/* see if any included files were found */
 		if(lastfile == nsrcfiles) { break; }
 		firstfile = lastfile;
@@ -409,52 +518,77 @@ void build(void) {
 	putlist(srcdirs, nsrcdirs);
 	putlist(incdirs, nincdirs);
 	putlist(srcfiles, nsrcfiles);
-	if(fflush(newrefs) == EOF) {
-		/* rewind doesn't check for write failure */
-		cannotwrite(newreffile);
-		/* NOTREACHED */
-	}
+	puthashes();
+	put_inccache();
+	dbflush();
 
 	/* create the inverted index if requested */
 	if(invertedindex == true) {
-		char sortcommand[PATHLEN + 1];
-
-		if(fflush(postings) == EOF) {
-			cannotwrite(temp1);
-			/* NOTREACHED */
-		}
-		fstat(fileno(postings), &file_status);
-		fclose(postings);
-		snprintf(sortcommand,
-			sizeof(sortcommand),
-			"env LC_ALL=C sort -T %s %s",
-			tmpdir,
-			temp1);
-		if((postings = mypopen(sortcommand, "r")) == NULL) {
-			fprintf(stderr, PROGRAM_NAME ": cannot open pipe to sort command\n");
+		bool sorted;
+
+		stats_begin(&start);
+		if(reusepostings == true && reusefailed == false) { postsort_merge(getoldposting); }
+		sorted = reusefailed == false && postsort_sort() == true;
+		stats_end(PHASE_SORT, &start);
+		if(reusefailed == true) {
+			/* the index is made again below */
+		} else if(sorted == false) {
 			cannotindex();
 		} else {
-			if((totalterms = invmake(newinvname, newinvpost, postings)) > 0) {
+			stats_begin(&start);
+			totalterms = invmake(newinvname, newinvpost, postsort_next);
+			stats_end(PHASE_INVMAKE, &start);
+			end_reuse();
+			if(reusefailed == true) {
+				unlink(newinvname);
+				unlink(newinvpost);
+			} else if(totalterms > 0) {
+				stats_begin(&start);
 				movefile(newinvname, invname);
 				movefile(newinvpost, invpost);
+				stats_end(PHASE_RENAME, &start);
 			} else {
 				cannotindex();
 			}
-			mypclose(postings);
 		}
-		unlink(temp1);
+		postsort_close();
 		free(srcoffset);
 	}
+	end_reuse();
+	free_hashes();
+
 	/* rewrite the header with the trailer offset and final option list */
-	rewind(newrefs);
+	dbrewind();
 	putheader(newdir);
-	fclose(newrefs);
+	dbclose();
 
 	/* close the old database file */
-	if(symrefs >= 0) { close(symrefs); }
+	if(symrefs >= 0) {
+		dbzclose(symrefs);
+		symrefs = -1;
+	}
 	if(oldrefs != NULL) { fclose(oldrefs); }
 	/* replace it with the new database file */
+	stats_begin(&start);
 	movefile(newreffile, reffile);
+	stats_end(PHASE_RENAME, &start);
+
+	/* if the old postings could not be reused, make them all again
+	 * from the database just built */
+	if(reusefailed == true) {
+		bool changed = fileschanged;
+
+		reusefailed	 = false;
+		noreuse		 = true;
+		fileschanged = true;
+		nsrcoffset	 = 0;
+		npostings	 = 0;
+		build();
+		fileschanged = changed;
+		noreuse		 = false;
+	} else {
+		stats_report();
+	}
 }
 
 /* string comparison function for qsort */
@@ -484,9 +618,11 @@ char *getoldfile(void) {
 	if(blockp != NULL) {
 		do {
 			if(*blockp == NEWFILE) {
+				oldfileoffset = blocknumber * BUFSIZ + (blockp - block) + 1;
 				skiprefchar();
 				fetch_string_from_dbase(file, sizeof(file));
 				if(file[0] != '\0') { /* if not end-of-crossref */
+					++oldfilenumber;
 					return file;
 				}
 				return NULL;
@@ -508,19 +644,19 @@ void free_newbuildfiles(void) {
    the database trailer offset */
 static
 void putheader(char *dir) {
-	dboffset = fprintf(newrefs, PROGRAM_NAME " %d %s", FILEVERSION, dir);
-	if(compress == false) { dboffset += fprintf(newrefs, " -c"); }
+	dbprintf(PROGRAM_NAME " %d %s", FILEVERSION, dir);
+	if(compress == false) { dbfputs(" -c"); } else { putdigraphs(); }
 	if(invertedindex == true) {
-		dboffset += fprintf(newrefs, " -q %.10ld", totalterms);
+		dbprintf(" -q %.10ld", totalterms);
 	} else {
 		/* leave space so if the header is overwritten without -q
 		 * because writing the inverted index failed, the header
 		 * is the same length */
-		dboffset += fprintf(newrefs, "              ");
+		dbfputs("              ");
 	}
-	if(trun_syms == true) { dboffset += fprintf(newrefs, " -T"); }
+	if(trun_syms == true) { dbfputs(" -T"); }
 
-	dboffset += fprintf(newrefs, " %.10ld\n", traileroffset);
+	dbprintf(" %.10ld\n", traileroffset);
 }
 
 /* put the name list into the cross-reference file */
@@ -528,20 +664,17 @@ static
 void putlist(char **names, int count) {
 	int size = 0;
 
-	fprintf(newrefs, "%d\n", count);
+	dbprintf("%d\n", count);
 	if(names == srcfiles) {
 		/* calculate the string space needed */
 		for(int i = 0; i < count; ++i) {
 			size += strlen(names[i]) + 1;
 		}
-		fprintf(newrefs, "%d\n", size);
+		dbprintf("%d\n", size);
 	}
 	for(int i = 0; i < count; i++) {
-		if(fputs(names[i], newrefs) == EOF
-        || putc('\n', newrefs) == EOF) {
-			cannotwrite(newreffile);
-			/* NOTREACHED */
-		}
+		dbfputs(names[i]);
+		dbputc('\n');
 	}
 }
 
@@ -553,11 +686,12 @@ void copydata(void) {
 	setmark('\t');
 	cp = blockp;
 	for(;;) {
-		/* copy up to the next \t */
-		do { /* innermost loop optimized to only one test */
-			while(*cp != '\t') {
-				dbputc(*cp++);
-			}
+		/* copy up to the next \t, or the mark at the end of the block */
+		do {
+			char *mark = memchr(cp, '\t', block + blocklen + 1 - cp);
+
+			dbwrite(cp, mark - cp);
+			cp = mark;
 		} while(*++cp == '\0' && (cp = read_crossreference_block()) != NULL);
 		dbputc('\t'); /* copy the tab */
 
@@ -594,10 +728,11 @@ void copyinverted(void) {
 	cp = blockp;
 	for(;;) {
 		setmark('\n');
-		do { /* innermost loop optimized to only one test */
-			while(*cp != '\n') {
-				dbputc(*cp++);
-			}
+		do { /* copy up to the next \n, or the mark at the end of the block */
+			char *mark = memchr(cp, '\n', block + blocklen + 1 - cp);
+
+			dbwrite(cp, mark - cp);
+			cp = mark;
 		} while(*++cp == '\0' && (cp = read_crossreference_block()) != NULL);
 		dbputc('\n'); /* copy the newline */
 
@@ -646,10 +781,9 @@ void copyinverted(void) {
 	blockp = cp;
 }
 
-/* replace the old file with the new file */
+/* replace the old file with the new file, so that readers see one or the other */
 static
 void movefile(char *new, char *old) {
-	unlink(old);
 	if(rename(new, old) == -1) {
 		myperror(PROGRAM_NAME);
 		postfatal(PROGRAM_NAME ": cannot rename file %s to file %s\n", new, old);
@@ -666,9 +800,460 @@ void fetch_include_from_dbase(char *s, size_t length) {
 	incfile(s + 1, s);
 }
 
-// -----------
+/* add bytes to an FNV-1a hash */
+unsigned long long hashbytes(unsigned long long hash, const char *s, size_t n) {
+	for(size_t i = 0; i < n; ++i) {
+		hash = (hash ^ (unsigned char)s[i]) * 1099511628211ull;
+	}
+	return hash;
+}
 
-static char tempdirpv[PATHLEN + 1];	/* private temp directory */
+/* get the hash and size of a file's contents */
+static
+bool hashfile(const char *file, filehash_t *h) {
+	char	buf[16 * BUFSIZ];
+	ssize_t n;
+	int		fd;
+
+	h->hash = HASHINIT;
+	h->size = 0;
+	if((fd = open(file, O_RDONLY)) == -1) {
+		h->size = -1;
+		return false;
+	}
+	while((n = read(fd, buf, sizeof(buf))) > 0) {
+		h->hash = hashbytes(h->hash, buf, n);
+		h->size += n;
+	}
+	close(fd);
+	if(n == -1) {
+		h->size = -1;
+		return false;
+	}
+	return true;
+}
+
+/* hash comparison function for qsort and bsearch */
+static
+int hash_compare(const void *h1, const void *h2) {
+	return strcmp(((const filehash_t *)h1)->name, ((const filehash_t *)h2)->name);
+}
+
+/* read the old source file content hashes that follow the file list
+ * in the trailer, and any #include cache after them,
+ * leaving the file at the trailer */
+static
+void read_old_hashes(FILE *oldrefs) {
+	char		  name[PATHLEN + 1];
+	unsigned long nnames;
+	unsigned long n;
+	bool		  samedirs = true;
+
+	free_hashes();
+
+	/* skip the directory lists, noting whether they are the same */
+	for(int list = 0; list < 2; ++list) {
+		char		**dirs	= (list == 0) ? srcdirs : incdirs;
+		unsigned long ndirs = (list == 0) ? nsrcdirs : nincdirs;
+
+		if(fscanf(oldrefs, "%lu", &n) != 1) { goto done; }
+		if(n != ndirs) { samedirs = false; }
+		for(unsigned long i = 0; i < n; ++i) {
+			if(fscanf(oldrefs, " %" PATHLEN_STR "[^\n]", name) != 1) { goto done; }
+			if(samedirs == true && strcmp(name, dirs[i]) != 0) { samedirs = false; }
+		}
+	}
+	/* get the source file names */
+	if(fscanf(oldrefs, "%lu", &nnames) != 1
+	|| (fileversion >= 9 && fscanf(oldrefs, "%*s") != 0)) {
+		goto done;
+	}
+	oldhashes = calloc(nnames, sizeof(*oldhashes));
+	for(noldhashes = 0; noldhashes < nnames; ++noldhashes) {
+		if(fscanf(oldrefs, " %" PATHLEN_STR "[^\n]", name) != 1) { goto done; }
+		oldhashes[noldhashes].name = strdup(name);
+	}
+	/* then their hashes, if this database has them */
+	if(fscanf(oldrefs, "%lu", &n) != 1 || n != nnames) { goto done; }
+	for(unsigned long i = 0; i < n; ++i) {
+		if(fscanf(oldrefs, "%llx %ld", &oldhashes[i].hash, &oldhashes[i].size) != 2) {
+			goto done;
+		}
+	}
+	qsort(oldhashes, noldhashes, sizeof(*oldhashes), hash_compare);
+
+	/* then the #include cache, if it was kept */
+	if(samedirs == true) { read_inccache(oldrefs); }
+	fseek(oldrefs, traileroffset, SEEK_SET);
+	return;
+done:
+	free_hashes();
+	fseek(oldrefs, traileroffset, SEEK_SET);
+}
+
+/* get the content hash slot of a source file */
+static
+filehash_t *srchash(unsigned long fileindex) {
+	if(fileindex >= nsrchashes) {
+		unsigned long n = nsrchashes;
+
+		nsrchashes = fileindex + 1024;
+		srchashes  = realloc(srchashes, nsrchashes * sizeof(*srchashes));
+		while(n < nsrchashes) {
+			srchashes[n++].size = -1;
+		}
+	}
+	return &srchashes[fileindex];
+}
+
+/* may the source file have changed since the old cross-reference was written
+ * at reftime: it was modified later, to the nanosecond, or it was seen
+ * changing while the database was watched */
+static
+bool newer(const char *file, const struct stat *file_status, const struct timespec *reftime) {
+	return file_status->st_mtim.tv_sec > reftime->tv_sec
+		|| (file_status->st_mtim.tv_sec == reftime->tv_sec
+			&& file_status->st_mtim.tv_nsec > reftime->tv_nsec)
+		|| watchchanged(file) == true;
+}
+
+/* see if a file whose time stamp changed has new contents */
+static
+bool content_changed(unsigned long fileindex, const struct stat *file_status) {
+	filehash_t	key = { .name = srcfiles[fileindex] };
+	filehash_t *old;
+	filehash_t *h;
+
+	if(noldhashes == 0
+	|| (old = bsearch(&key, oldhashes, noldhashes, sizeof(*oldhashes), hash_compare)) == NULL
+	|| old->size != file_status->st_size) {
+		return true;
+	}
+	h = srchash(fileindex);
+	if(h->size == -1 && hashfile(srcfiles[fileindex], h) == false) { return true; }
+	return h->hash != old->hash || h->size != old->size;
+}
+
+/* put the source file content hashes into the cross-reference file */
+static
+void puthashes(void) {
+	filehash_t	h;
+	filehash_t *old;
+
+	dbprintf("%lu\n", nsrcfiles);
+	for(unsigned long i = 0; i < nsrcfiles; ++i) {
+		h.name = srcfiles[i];
+		if(i < nsrchashes && srchashes[i].size != -1) {
+			/* hashed when checked or cross-referenced */
+			h = srchashes[i];
+		} else if(noldhashes > 0
+			&& (old = bsearch(&h, oldhashes, noldhashes, sizeof(*oldhashes), hash_compare)) != NULL) {
+			/* copied unchanged */
+			h = *old;
+		} else {
+			hashfile(srcfiles[i], &h);
+		}
+		dbprintf("%016llx %ld\n", h.hash, h.size);
+	}
+}
+
+/* free the source file content hashes */
+static
+void free_hashes(void) {
+	for(unsigned long i = 0; i < noldhashes; ++i) {
+		free(oldhashes[i].name);
+	}
+	free(oldhashes);
+	oldhashes  = NULL;
+	noldhashes = 0;
+	free(srchashes);
+	srchashes  = NULL;
+	nsrchashes = 0;
+}
+
+/* open the old inverted index to reuse the postings of the copied files */
+static
+void start_reuse(void) {
+	reusepostings = false;
+	reusefailed	  = false;
+	if(totalterms > 0 && invopen(&oldinvcontrol, invname, invpost, INVAVAIL) != -1) {
+		/* move to the null term that precedes the first real term */
+		UNUSED(invfind(&oldinvcontrol, ""));
+		reusepostings  = true;
+		nreusedelta	   = 0;
+		noldpostings   = 0;
+		nextoldposting = 0;
+	}
+}
+
+/* copy this file's symbol data and note how its database offsets moved,
+ * for the old postings to be reused */
+static
+void copyreused(void) {
+	long oldstart = oldfileoffset;
+	long newstart = dboffset;
+
+	copydata();
+
+	/* the data must have been copied unchanged up to the next file */
+	if(blockp == NULL || *blockp != NEWFILE
+	|| blocknumber * BUFSIZ + (blockp - block) - oldstart != dboffset - newstart) {
+		reusefailed = true;
+		return;
+	}
+	if(oldfilenumber >= nreusedelta) {
+		long n = nreusedelta;
+
+		nreusedelta = oldfilenumber + 1024;
+		reusedelta	= realloc(reusedelta, nreusedelta * sizeof(*reusedelta));
+		while(n < nreusedelta) {
+			reusedelta[n++] = NOREUSE;
+		}
+	}
+	reusedelta[oldfilenumber] = newstart - oldstart;
+}
+
+/* close the old inverted index */
+static
+void end_reuse(void) {
+	if(reusepostings == true) {
+		invclose(&oldinvcontrol);
+		reusepostings = false;
+	}
+	free(reusedelta);
+	reusedelta	= NULL;
+	nreusedelta = 0;
+	free(oldpostings);
+	oldpostings	 = NULL;
+	moldpostings = 0;
+}
+
+/* get the next old posting of a copied file, at its new database offset;
+ * they come in the order of the postings sort */
+static
+const TERMPOSTING *getoldposting(void) {
+	static TERMPOSTING termposting;
+	POSTING			  *p;
+	long			   delta;
+
+	for(;;) {
+		while(nextoldposting < noldpostings) {
+			p = &oldpostings[nextoldposting++];
+			if(p->fileindex < 0 || p->fileindex >= nreusedelta
+			|| (delta = reusedelta[p->fileindex]) == NOREUSE) {
+				continue;
+			}
+			termposting.term	   = oldterm;
+			termposting.lineoffset = p->lineoffset + delta;
+			termposting.fcnoffset  = (p->fcnoffset != 0) ? p->fcnoffset + delta : 0;
+			termposting.type	   = p->type;
+			return &termposting;
+		}
+		/* get the next term's postings */
+		nextoldposting = 0;
+		noldpostings   = 0;
+		if(invforward(&oldinvcontrol) == 0) { return NULL; }
+		noldpostings = invterm(&oldinvcontrol, oldterm);
+		if(noldpostings > moldpostings) {
+			moldpostings = noldpostings;
+			oldpostings	 = realloc(oldpostings, moldpostings * sizeof(*oldpostings));
+		}
+		if(oldpostings == NULL || invpostings(&oldinvcontrol, oldpostings) != noldpostings) {
+			reusefailed	 = true;
+			noldpostings = 0;
+			return NULL;
+		}
+	}
+}
+
+/* lex the files of this pass that are certain to be cross-referenced
+ * in parallel build jobs, each writing one job file per source file;
+ * the files are marked in the returned array (NULL if no jobs were run) */
+static
+bool *start_jobs(unsigned long firstfile, unsigned long lastfile, const struct timespec *reftime) {
+	struct stat	   file_status;
+	unsigned long *todo;
+	unsigned long  ntodo = 0;
+	bool		  *jobdone;
+	pid_t		  *pids;
+	int			   jobs;
+
+	if(buildjobs <= 1) { return NULL; }
+
+	/* new and modified files; the rest may only need to be copied */
+	todo = malloc((lastfile - firstfile) * sizeof(*todo));
+	for(unsigned long i = firstfile; i < lastfile; ++i) {
+		if(reftime->tv_sec == 0
+		|| (lstat(srcfiles[i], &file_status) == 0 && newer(srcfiles[i], &file_status, reftime)
+			&& content_changed(i, &file_status))) {
+			todo[ntodo++] = i;
+		}
+	}
+	if(ntodo < 2) {
+		free(todo);
+		return NULL;
+	}
+	jobs = (ntodo < (unsigned long)buildjobs) ? (int)ntodo : buildjobs;
+
+	/* the jobs must not inherit buffered output */
+	dbflush();
+	fflush(stdout);
+
+	jobdone = calloc(lastfile - firstfile, sizeof(*jobdone));
+	pids	= malloc(jobs * sizeof(*pids));
+	for(int job = 0; job < jobs; ++job) {
+		if((pids[job] = fork()) == 0) {
+			run_job(todo, ntodo, job, jobs);
+			/* NOTREACHED */
+		}
+	}
+	for(int job = 0; job < jobs; ++job) {
+		int status = -1;
+
+		if(pids[job] == -1) { continue; } /* lexed by crossref_file() */
+		while(waitpid(pids[job], &status, 0) == -1 && errno == EINTR) { ; }
+		if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			for(unsigned long k = job; k < ntodo; k += jobs) {
+				jobdone[todo[k] - firstfile] = true;
+			}
+		}
+	}
+	free(pids);
+	free(todo);
+	return jobdone;
+}
+
+/* build job: cross-reference every jobs'th file of the list into its job file */
+static
+void run_job(const unsigned long *todo, unsigned long ntodo, int job, int jobs) {
+	char			path[PATHLEN + 1];
+	struct timespec begin, end;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	/* errors are reported on stderr and must not clean up after the parent */
+	incurses			  = false;
+	linemode			  = true;
+	remove_symfile_onexit = false;
+	temp1[0]			  = '\0';
+
+	/* the postings are made when the job file is copied */
+	invertedindex = false;
+	/* and the job file is read back with plain reads */
+	blockcompress = false;
+
+	for(unsigned long k = job; k < ntodo; k += jobs) {
+		job_file_name(path, sizeof(path), todo[k]);
+		if(dbcreate(path) == false) { _exit(1); }
+
+		/* the job file looks like a database with a single file,
+		 * after the hash and size of the contents lexed and the time taken */
+		putjobheader(0);
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		crossref(srcfiles[todo[k]]);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		putfilename("");
+		dbputc('\n');
+		dbrewind();
+		putjobheader((end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9);
+		dbclose(); /* exits on a write error */
+	}
+	_exit(0);
+}
+
+/* put the lexed contents' hash and size and the time taken to lex them
+ * before a job file's cross-reference, in a fixed width so that it can be rewritten */
+static
+void putjobheader(double seconds) {
+	dbprintf("%016llx %20ld %20.9f\t", lexedhash, lexedsize, seconds);
+}
+
+static
+void job_file_name(char *path, size_t size, unsigned long fileindex) {
+	snprintf(path, size, "%s/" PROGRAM_NAME ".j%lu", tempdirpv, fileindex);
+}
+
+/* copy the cross-reference written by a build job as if it
+ * came from an old database, which also outputs its postings,
+ * and get the hash of the contents the job lexed and its time for them */
+static
+bool copy_job_file(unsigned long fileindex, filehash_t *h, double *seconds) {
+	static blockstate_t saved;
+	char				path[PATHLEN + 1];
+	char				file[PATHLEN + 1];
+	int					fd;
+	bool				copied = false;
+
+	job_file_name(path, sizeof(path), fileindex);
+	if((fd = myopen(path, O_BINARY | O_RDONLY, 0)) == -1) { return false; }
+
+	/* the old database may be in the middle of being copied */
+	saved.symrefs	  = symrefs;
+	saved.blocknumber = blocknumber;
+	saved.blocklen	  = blocklen;
+	saved.blockmark	  = blockmark;
+	saved.blockp	  = blockp;
+	saved.block		  = block;
+	memcpy(saved.blockbuf, blockbuf, sizeof(saved.blockbuf));
+
+	symrefs		= fd;
+	blocknumber = -1;
+	if(read_crossreference_block() != NULL
+	&& sscanf(blockp, "%llx %ld %lf", &h->hash, &h->size, seconds) == 3
+	&& scanpast('\t') != NULL && *blockp == NEWFILE) {
+		skiprefchar();
+		fetch_string_from_dbase(file, sizeof(file));
+		copied = true;
+		if(*file != '\0') {
+			putfilename(srcfiles[fileindex]);
+			if(invertedindex == true) {
+				copyinverted();
+			} else {
+				copydata();
+			}
+		} else { /* the job could not open the source file */
+			errorsfound = true;
+		}
+	}
+	close(fd);
+	unlink(path);
+
+	symrefs		= saved.symrefs;
+	blocknumber = saved.blocknumber;
+	blocklen	= saved.blocklen;
+	blockmark	= saved.blockmark;
+	blockp		= saved.blockp;
+	block		= saved.block;
+	memcpy(blockbuf, saved.blockbuf, sizeof(saved.blockbuf));
+	return copied;
+}
+
+/* cross-reference a file, or copy it if a build job already did */
+static
+void crossref_file(bool *jobdone, unsigned long firstfile, unsigned long fileindex) {
+	filehash_t *h = srchash(fileindex);
+	stattime_t	start;
+	double		seconds;
+
+	/* the new database has the hash of what was cross-referenced */
+	stats_begin(&start);
+	if(jobdone != NULL && jobdone[fileindex - firstfile] == true
+	&& copy_job_file(fileindex, h, &seconds) == true) {
+		stats_lexed(srcfiles[fileindex], h->size, &start, seconds);
+		return;
+	}
+	crossref(srcfiles[fileindex]);
+	h->hash = lexedhash;
+	h->size = lexedsize;
+	/* only an unmappable file is read again */
+	if(h->size == -1) { hashfile(srcfiles[fileindex], h); }
+	stats_lexed(srcfiles[fileindex], h->size, &start, -1);
+}
+
+// -----------
 
 void init_temp_files(void) {
 	/* make sure that tmpdir exists */
@@ -703,6 +1288,21 @@ void deinit_temp_files(void) {
 	if(temp1[0] != '\0') {
 		unlink(temp1);
 		unlink(temp2);
+
+		/* job and sort run files of an interrupted build */
+		DIR *dir = opendir(tempdirpv);
+		if(dir != NULL) {
+			struct dirent *entry;
+			char		   path[PATHLEN + 1];
+			while((entry = readdir(dir)) != NULL) {
+				if(strncmp(entry->d_name, PROGRAM_NAME ".j", sizeof(PROGRAM_NAME ".j") - 1) == 0
+					|| strncmp(entry->d_name, PROGRAM_NAME ".s", sizeof(PROGRAM_NAME ".s") - 1) == 0) {
+					snprintf(path, sizeof(path), "%s/%s", tempdirpv, entry->d_name);
+					unlink(path);
+				}
+			}
+			closedir(dir);
+		}
 		rmdir(tempdirpv);
 	}
 }
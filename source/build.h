@@ -35,33 +35,32 @@
 
 #include "global.h" /* FIXME: temp. only */
 #include "invlib.h"
+#include "dbwrite.h"
 
 /* types and macros of build.c to be used by other modules */
 
-/* database output macros that update its offset */
-#define dbputc(c)  (++dboffset, (void)putc(c, newrefs))
-#define dbfputs(s) (dboffset += strlen(s), fputs(s, newrefs))
-
 /* declarations for globals defined in build.c */
 
 extern bool buildonly;		  /* only build the database */
 extern bool unconditional;	  /* unconditionally build database */
 extern bool fileschanged;	  /* assume some files changed */
+extern int	buildjobs;		  /* parallel cross-reference jobs */
 
 extern char *reffile;		  /* cross-reference file path name */
 extern char *invname;		  /* inverted index to the database */
 extern char *invpost;		  /* inverted index postings */
 extern char *newreffile;	  /* new cross-reference file name */
-extern FILE *newrefs;		  /* new cross-reference */
-extern FILE *postings;		  /* new inverted index postings */
 extern int	 symrefs;		  /* cross-reference file */
 
 extern INVCONTROL invcontrol; /* inverted file control structure */
 
+#define HASHINIT 14695981039346656037ull /* FNV-1a offset basis */
+
 /* Prototypes of external functions defined by build.c */
 
 void build(void);
 void free_newbuildfiles(void);
+unsigned long long hashbytes(unsigned long long hash, const char *s, size_t n);
 void opendatabase(const char * const reffile);
 void rebuild(void);
 void setup_build_filenames(const char * const reffile);
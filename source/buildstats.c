@@ -0,0 +1,199 @@
+#include "global.h"
+#include "build.h"
+#include "buildstats.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+/* The phases of a build are timed when --build-stats is given,
+ *  and a report is written to stderr as one line of JSON at its end.
+ * Phase times add up all the intervals spent in the phase;
+ *  finding #include files happens while lexing and copying,
+ *  so its time is also part of theirs.
+ * CPU times are those of this process; the build jobs' CPU time
+ *  is reported on its own.
+ */
+
+typedef struct { /* time spent in a phase */
+	double wall;
+	double cpu;
+} phasetime_t;
+
+typedef struct { /* a slow file */
+	char  *file;
+	double seconds;
+	long   bytes;
+} slowfile_t;
+
+bool buildstats = false;
+
+static const char *const phasenames[NPHASES] = {
+	"discovery", "includes", "crossref", "copy", "sort", "invmake", "rename",
+};
+
+static phasetime_t phases[NPHASES];
+static slowfile_t  slowest[STATSLOWEST];
+static int		   nslowest;
+static long		   lexedfiles;
+static long		   lexedbytes;
+static long		   copiedfiles;
+static long		   copiedbytes;	 /* database bytes copied */
+static stattime_t  buildstart;	 /* start of the first timed phase */
+static double	   jobsstart;	 /* build jobs' CPU time then */
+static bool		   started;
+
+static double seconds(const struct timespec *from, const struct timespec *to);
+static double jobscpu(void);
+static void	  putjsonstring(const char *s);
+static long	  filesize(const char *file);
+
+static
+double seconds(const struct timespec *from, const struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/* get the CPU time of the finished build jobs */
+static
+double jobscpu(void) {
+	struct rusage children;
+
+	getrusage(RUSAGE_CHILDREN, &children);
+	return children.ru_utime.tv_sec + children.ru_utime.tv_usec / 1e6 + children.ru_stime.tv_sec
+		 + children.ru_stime.tv_usec / 1e6;
+}
+
+/* start timing an interval */
+void stats_begin(stattime_t *start) {
+	if(buildstats == false) { return; }
+	clock_gettime(CLOCK_MONOTONIC, &start->wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start->cpu);
+	if(started == false) {
+		buildstart = *start;
+		jobsstart  = jobscpu();
+		started	   = true;
+	}
+}
+
+/* add the interval to the time spent in the phase */
+void stats_end(buildphase_t phase, const stattime_t *start) {
+	struct timespec now;
+
+	if(buildstats == false) { return; }
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	phases[phase].wall += seconds(&start->wall, &now);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	phases[phase].cpu += seconds(&start->cpu, &now);
+}
+
+/* count a cross-referenced file, remembering it if it is one of the slowest;
+ * a file lexed by a build job has the job's time for it (else it is negative),
+ * as the time here is only that of copying its output */
+void stats_lexed(const char *file, long bytes, const stattime_t *start, double jobseconds) {
+	struct timespec now;
+	double			s;
+	int				i;
+
+	if(buildstats == false) { return; }
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	s = seconds(&start->wall, &now);
+	stats_end(PHASE_CROSSREF, start);
+	++lexedfiles;
+	if(bytes > 0) { lexedbytes += bytes; }
+	if(jobseconds >= 0) { s = jobseconds; }
+
+	/* keep the slowest files in decreasing order of time */
+	if(nslowest == STATSLOWEST && s <= slowest[nslowest - 1].seconds) { return; }
+	if(nslowest == STATSLOWEST) { free(slowest[--nslowest].file); }
+	for(i = nslowest++; i > 0 && slowest[i - 1].seconds < s; --i) {
+		slowest[i] = slowest[i - 1];
+	}
+	slowest[i].file	   = strdup(file);
+	slowest[i].seconds = s;
+	slowest[i].bytes   = bytes;
+}
+
+/* count a file whose data was copied from the old database */
+void stats_copied(long bytes, const stattime_t *start) {
+	if(buildstats == false) { return; }
+	stats_end(PHASE_COPY, start);
+	++copiedfiles;
+	copiedbytes += bytes;
+}
+
+/* output a JSON string */
+static
+void putjsonstring(const char *s) {
+	putc('"', stderr);
+	for(; *s != '\0'; ++s) {
+		if(*s == '"' || *s == '\\') {
+			fprintf(stderr, "\\%c", *s);
+		} else if((unsigned char)*s < ' ') {
+			fprintf(stderr, "\\u%04x", (unsigned char)*s);
+		} else {
+			putc(*s, stderr);
+		}
+	}
+	putc('"', stderr);
+}
+
+/* get the size of a file, or 0 */
+static
+long filesize(const char *file) {
+	struct stat st;
+
+	return (stat(file, &st) == 0) ? (long)st.st_size : 0;
+}
+
+/* report the statistics of the build that just finished and reset them */
+void stats_report(void) {
+	struct timespec now;
+	double			total;
+	double			lexing = phases[PHASE_CROSSREF].wall;
+	long			written;
+
+	if(buildstats == false) { return; }
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	total = started == true ? seconds(&buildstart.wall, &now) : 0;
+
+	written = filesize(reffile);
+	if(invertedindex == true) { written += filesize(invname) + filesize(invpost); }
+
+	fprintf(stderr,
+		"{\"files\":%lu,\"lexed\":%ld,\"copied\":%ld,"
+		"\"bytes_lexed\":%ld,\"bytes_copied\":%ld,\"bytes_written\":%ld,\"postings\":%ld,",
+		nsrcfiles,
+		lexedfiles,
+		copiedfiles,
+		lexedbytes,
+		copiedbytes,
+		written,
+		npostings);
+	fprintf(stderr,
+		"\"wall\":%.6f,\"files_per_second\":%.1f,\"jobs_cpu\":%.6f,\"phases\":{",
+		total,
+		lexing > 0 ? lexedfiles / lexing : 0.0,
+		started == true ? jobscpu() - jobsstart : 0);
+	for(int i = 0; i < NPHASES; ++i) {
+		fprintf(stderr,
+			"%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}",
+			i > 0 ? "," : "",
+			phasenames[i],
+			phases[i].wall,
+			phases[i].cpu);
+	}
+	fputs("},\"slowest\":[", stderr);
+	for(int i = 0; i < nslowest; ++i) {
+		fputs(i > 0 ? ",{\"file\":" : "{\"file\":", stderr);
+		putjsonstring(slowest[i].file);
+		fprintf(stderr, ",\"seconds\":%.6f,\"bytes\":%ld}", slowest[i].seconds, slowest[i].bytes);
+		free(slowest[i].file);
+	}
+	fputs("]}\n", stderr);
+
+	/* the next build, as in watch mode, starts afresh */
+	memset(phases, 0, sizeof(phases));
+	nslowest	= 0;
+	lexedfiles	= lexedbytes = 0;
+	copiedfiles = copiedbytes = 0;
+	started		= false;
+}
@@ -0,0 +1,34 @@
+#ifndef BUILDSTATS_H
+#define BUILDSTATS_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#define STATSLOWEST 10 /* number of slowest files reported */
+
+/* database build phases that are timed */
+typedef enum {
+	PHASE_DISCOVERY, /* making the source file list */
+	PHASE_INCLUDES,	 /* finding #include files, during lexing and copying */
+	PHASE_CROSSREF,	 /* lexing the new and changed files */
+	PHASE_COPY,		 /* copying the unchanged files' data */
+	PHASE_SORT,		 /* sorting the inverted index postings */
+	PHASE_INVMAKE,	 /* making the inverted index */
+	PHASE_RENAME,	 /* replacing the old files */
+	NPHASES
+} buildphase_t;
+
+typedef struct { /* start of a timed interval */
+	struct timespec wall;
+	struct timespec cpu;
+} stattime_t;
+
+extern bool buildstats; /* report the build statistics */
+
+void stats_begin(stattime_t *start);
+void stats_end(buildphase_t phase, const stattime_t *start);
+void stats_lexed(const char *file, long bytes, const stattime_t *start, double jobseconds);
+void stats_copied(long bytes, const stattime_t *start);
+void stats_report(void);
+
+#endif
@@ -39,35 +39,23 @@
 #include "global.h"
 
 #include "build.h"
+#include "postsort.h"
 #include "scanner.h"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
-/* convert long to a string in base BASE notation */
-#define ltobase(value)                                                                   \
-	do {                                                                                 \
-		n	   = (value);                                                                \
-		s	   = buf + (sizeof(buf) - 1);                                                \
-		*s	   = '\0';                                                                   \
-		digits = 1;                                                                      \
-		while(n >= BASE) {                                                               \
-			++digits;                                                                    \
-			int i = n;                                                                   \
-			n /= BASE;                                                                   \
-			*--s = i - n * BASE + '!';                                                   \
-		}                                                                                \
-		*--s = n + '!';                                                                  \
-	} while(0)
-
 #define SYMBOLINC 20					   /* symbol list size increment */
+#define SYMSLOTINIT 64					   /* initial symbol hash table size, a power of 2 */
 
-long		  dboffset;					   /* new database offset */
 bool		  errorsfound;				   /* prompt before clearing messages */
 long		  lineoffset;				   /* source line database offset */
 long		  npostings;				   /* number of postings */
 int			  nsrcoffset;				   /* number of file name database offsets */
 long		 *srcoffset;				   /* source file name database offsets */
 unsigned long symbols;					   /* number of symbols */
+unsigned long long lexedhash;			   /* content hash of the file last cross-referenced */
+long		  lexedsize;				   /* and its size, or -1 if it was not mapped */
 
 static char			*filename;			   /* file name for warning messages */
 static long			 fcnoffset;			   /* function name database offset */
@@ -83,14 +71,76 @@ typedef struct {							   /* symbol data */
 } symbol_t;
 static symbol_t * symbol;
 
+/* the symbols of the current line are also in a hash table,
+ * whose slots are only in use when marked with the current line,
+ * so that it need not be cleared for each line */
+typedef struct {				/* symbol hash table slot */
+	unsigned long line;			/* line the slot is in use for */
+	unsigned int  symbol;		/* symbol list index */
+} symslot_t;
+static symslot_t	*symslot;			/* symbol hash table */
+static unsigned long msymslots;			/* symbol hash table size */
+static unsigned long symline = 1;		/* current line mark */
+
+static bool opensource(char *srcfile);
+static void closesource(void);
 static void putcrossref(void);
+static unsigned int hashsymbol(const char *text, unsigned int length, int token, unsigned int num);
+static void growsymslots(void);
+static symslot_t *findsymbol(int token, unsigned int num, unsigned int length);
 static void savesymbol(int token, int num);
 
+/* open the source file for the scanner, mapping it when possible,
+ * and hash the contents that are lexed */
+static
+bool opensource(char *srcfile) {
+	struct stat st;
+	void	   *p;
+	int			fd;
+
+	if((fd = myopen(srcfile, O_RDONLY, 0)) == -1) { return false; }
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { st.st_size = -1; }
+	if(st.st_size > 0
+	&& (p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+		(void)madvise(p, st.st_size, MADV_SEQUENTIAL);
+		scanbuffer = p;
+		scanlength = st.st_size;
+		close(fd); /* the mapping stays */
+		lexedhash = hashbytes(HASHINIT, scanbuffer, scanlength);
+		lexedsize = scanlength;
+		return true;
+	}
+	/* empty or unmappable files are read through stdio */
+	scanbuffer = NULL;
+	if(st.st_size == 0) {
+		lexedhash = HASHINIT;
+		lexedsize = 0;
+	}
+	if((yyin = fdopen(fd, "r")) == NULL) {
+		close(fd);
+		return false;
+	}
+	return true;
+}
+
+/* close the source file */
+static
+void closesource(void) {
+	if(scanbuffer != NULL) {
+		munmap((void *)scanbuffer, scanlength);
+		scanbuffer = NULL;
+	} else {
+		(void)fclose(yyin);
+		yyin = NULL; /* flex may look at it again for the next file */
+	}
+}
+
 void crossref(char * srcfile) {
 	unsigned int length;   /* symbol length */
 	unsigned int entry_no; /* function level of the symbol */
 	struct stat	 st;
 
+	lexedsize = -1;
 	if(!((stat(srcfile, &st) == 0) && S_ISREG(st.st_mode))) {
 		cannotopen(srcfile);
 		errorsfound = true;
@@ -99,8 +149,7 @@ void crossref(char * srcfile) {
 
 	entry_no = 0;
 	/* open the source file */
-    yyin = myfopen(srcfile, "r");
-	if(!yyin) {
+	if(opensource(srcfile) == false) {
 		cannotopen(srcfile);
 		errorsfound = true;
 		return;
@@ -115,6 +164,7 @@ void crossref(char * srcfile) {
 	initscanner(srcfile);
 	fcnoffset = macrooffset = 0;
 	symbols					= 0;
+	++symline;
 	if(symbol == NULL) { symbol = malloc(msymbols * sizeof(*symbol)); }
 	for(;;) {
 	    int token;   /* current token */
@@ -136,21 +186,15 @@ void crossref(char * srcfile) {
 				/* update entry_no if see function entry */
 				if(token == FCNDEF) { entry_no++; }
 				/* see if the symbol is already in the list */
-                {
-                    unsigned i;
-                    for(i = 0; i < symbols; ++i) {
-                        if(length == symbol[i].length &&
-                            strncmp(my_yytext + first, my_yytext + symbol[i].first, length) ==
-                                0 &&
-                            entry_no == symbol[i].fcn_level &&
-                            token == symbol[i].type) { /* could be a::a() */
-                            break;
-                        }
-                    }
-                    if(i == symbols) { /* if not already in list */
-                        savesymbol(token, entry_no);
-                    }
-                }
+				{
+					symslot_t *slot = findsymbol(token, entry_no, length);
+
+					if(slot->line != symline) { /* if not already in list */
+						slot->line	 = symline;
+						slot->symbol = symbols;
+						savesymbol(token, entry_no);
+					}
+				}
 				break;
 
 			case NEWLINE:			/* end of line containing symbols */
@@ -172,7 +216,7 @@ void crossref(char * srcfile) {
 
 						 /* if there were symbols, output them and the source line */
 				if(symbols > 0) { putcrossref(); }
-				(void)fclose(yyin); /* close the source file */
+				closesource(); /* close the source file */
 
 				/* output the leading tab expected by the next call */
 				dbputc('\t');
@@ -181,6 +225,66 @@ void crossref(char * srcfile) {
 	}
 }
 
+/* hash the symbol text, type and function level */
+static
+unsigned int hashsymbol(const char *text, unsigned int length, int token, unsigned int num) {
+	unsigned int h = 2166136261u; /* FNV-1a */
+
+	for(unsigned int i = 0; i < length; ++i) {
+		h = (h ^ (unsigned char)text[i]) * 16777619u;
+	}
+	h = (h ^ (unsigned int)token) * 16777619u;
+	h = (h ^ num) * 16777619u;
+	return h;
+}
+
+/* double the symbol hash table, moving the symbols of the current line */
+static
+void growsymslots(void) {
+	unsigned long mask;
+
+	free(symslot);
+	msymslots = (msymslots == 0) ? SYMSLOTINIT : msymslots * 2;
+	if((symslot = calloc(msymslots, sizeof(*symslot))) == NULL) {
+		postfatal(PROGRAM_NAME ": out of memory for the symbol table\n");
+		/* NOTREACHED */
+	}
+	mask = msymslots - 1;
+	for(unsigned int i = 0; i < symbols; ++i) {
+		unsigned long h;
+
+		if(symbol[i].length == 0) { continue; } /* not in the table */
+		h = hashsymbol(my_yytext + symbol[i].first, symbol[i].length, symbol[i].type,
+			symbol[i].fcn_level);
+		for(h &= mask; symslot[h].line == symline; h = (h + 1) & mask) { ; }
+		symslot[h].line	  = symline;
+		symslot[h].symbol = i;
+	}
+}
+
+/* find the hash table slot of the symbol at first,
+ * which is not in use if the symbol is not yet in the list */
+static
+symslot_t *findsymbol(int token, unsigned int num, unsigned int length) {
+	unsigned long mask;
+	unsigned long h;
+
+	/* keep the table at most half full */
+	if(2 * (symbols + 1) > msymslots) { growsymslots(); }
+	mask = msymslots - 1;
+	for(h = hashsymbol(my_yytext + first, length, token, num) & mask;; h = (h + 1) & mask) {
+		symslot_t *slot = &symslot[h];
+		symbol_t  *s;
+
+		if(slot->line != symline) { return slot; }
+		s = &symbol[slot->symbol];
+		if(length == s->length && strncmp(my_yytext + first, my_yytext + s->first, length) == 0
+		&& num == s->fcn_level && token == s->type) { /* could be a::a() */
+			return slot;
+		}
+	}
+}
+
 /* save the symbol in the list */
 static void savesymbol(int token, int num) {
 	/* make sure there is room for the symbol */
@@ -199,13 +303,7 @@ static void savesymbol(int token, int num) {
 
 /* output the file name */
 void putfilename(char *srcfile) {
-	/* check for file system out of space */
-	/* note: dbputc is not used to avoid lint complaint */
-	if(putc(NEWFILE, newrefs) == EOF) {
-		cannotwrite(newreffile);
-		/* NOTREACHED */
-	}
-	++dboffset;
+	dbputc(NEWFILE);
 	if(invertedindex == true) { srcoffset[nsrcoffset++] = dboffset; }
 	dbfputs(srcfile);
 	fcnoffset = macrooffset = 0;
@@ -222,7 +320,7 @@ void putcrossref(void) {
 
 	/* output the source line */
 	lineoffset = dboffset;
-	dboffset += fprintf(newrefs, "%d ", lineno);
+	dbprintf("%d ", lineno);
 
 	my_yytext[my_yyleng] = '\0';
 
@@ -337,6 +435,7 @@ void putcrossref(void) {
 		macrooffset = 0;
 	}
 	symbols = 0;
+	++symline;
 }
 
 /* HBB 20000421: new function, for avoiding memory leaks */
@@ -345,15 +444,14 @@ void freecrossref() {
 	if (symbol) { free(symbol); }
 	symbol	= NULL;
 	symbols = 0;
+	free(symslot);
+	symslot	  = NULL;
+	msymslots = 0;
 }
 
 /* output the inverted index posting */
 void putposting(char *term, int type) {
-	long  n;
-	char *s;
-	int	  digits;  /* digits output */
-	long  offset;  /* function/macro database offset */
-	char  buf[11]; /* number buffer */
+	long offset; /* function/macro database offset */
 
 	/* get the function or macro name offset */
 	offset = fcnoffset;
@@ -377,59 +475,42 @@ void putposting(char *term, int type) {
 	if (*term == '\0') { return; }
 	/* skip any #include secondary type char (< or ") */
 	if (type == INCLUDE) { ++term; }
-	/* output the posting, which should be as small as possible to reduce
-	   the temp file size and sort time */
-	(void)fputs(term, postings);
-	(void)putc(' ', postings);
-
-	/* the line offset is padded so postings for the same term will sort
-	   in ascending line offset order to order the references as they
-	   appear withing a source file */
-	ltobase(lineoffset);
-	for (long i = PRECISION - digits; i > 0; --i) {
-		(void)putc('!', postings);
-	}
-	do {
-		(void)putc(*s, postings);
-	} while(*++s != '\0');
-
-	/* postings are also sorted by type */
-	(void)putc(type, postings);
-
-	/* function or macro name offset */
-	if (offset > 0) {
-		(void)putc(' ', postings);
-		ltobase(offset);
-		do {
-			(void)putc(*s, postings);
-		} while(*++s != '\0');
-	}
-	if (putc('\n', postings) == EOF) {
-		cannotwrite(temp1);
-		/* NOTREACHED */
-	}
+	/* output the posting; postings are sorted by term, line offset
+	   to order the references as they appear within a source file,
+	   type and then function or macro name offset */
+	postsort_add(term, strnlen(term, PATLEN), lineoffset, type, offset);
 	++npostings;
 }
 
 /* put the string into the new database */
 void writestring(char *s) {
 	unsigned char c;
+	size_t		  length;
+	char		 *out;
 
 	if(compress == false) {
-		/* Save some I/O overhead by using puts() instead of putc(): */
-		dbfputs(s);
+		dbfputs(s); /* copy it as it is */
 		return;
 	}
-	/* compress digraphs */
+	/* compress digraphs straight into the output buffer,
+	 * which compression can only make shorter */
+	length = strlen(s);
+	out	   = dbreserve(length < DBBUFSIZE ? length : DBBUFSIZE);
 	for(int i = 0; (c = s[i]) != '\0'; ++i) {
+		if(out == dbbufend) { /* only for a string longer than the buffer */
+			dbbufp = out;
+			dbflush();
+			out = dbbufp;
+		}
 		if(/* dicode1[c] && dicode2[(unsigned char) s[i + 1]] */
 			IS_A_DICODE(c, s[i + 1])) {
 			/* c = (0200 - 2) + dicode1[c] + dicode2[(unsigned char) s[i + 1]]; */
 			c = DICODE_COMPRESS(c, s[i + 1]);
 			++i;
 		}
-		dbputc(c);
+		*out++ = c;
 	}
+	dbbufp = out;
 }
 
 /* print a warning message with the file name and line number */
@@ -0,0 +1,554 @@
+#define _GNU_SOURCE /* fopencookie(), which is why global.h is not included */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "vpath.h"
+#include "dbblock.h"
+
+/* A block-compressed database holds exactly the bytes of a plain one,
+ *  cut into DBBLOCKSIZE blocks that are each compressed on their own.
+ * A table at the end of the file gives the place of every block,
+ *  so any database offset, such as a posting's lineoffset,
+ *  is read by decompressing the one block holding it.
+ * The first block is written last, after dbrewind() has
+ *  rewritten the header, which is why the table is needed
+ *  even for a sequential scan.
+ *
+ * File layout:
+ *  header	magic, block size, uncompressed length, table offset
+ *  blocks	compressed, or stored when that is not smaller
+ *  table	offset and size of each block in database order
+ */
+
+#define DBZMAGIC	 "\211csopez\n"
+#define DBZMAGICLEN	 8
+#define DBZVERSION	 1
+#define DBZTABLEINIT 256
+
+#define LZMINMATCH	 4	/* shortest match */
+#define LZLASTLITS	 5	/* a block ends with at least this many literals */
+#define LZMFLIMIT	 12 /* no match may start this close to the end */
+#define LZHASHBITS	 13
+
+typedef struct {
+	uint32_t magicpad[DBZMAGICLEN / 4];
+	uint32_t blocksize;
+	uint32_t version;
+	uint64_t length; /* uncompressed length */
+	uint64_t table;	 /* file offset of the block table */
+} dbzheader_t;
+
+typedef struct {
+	uint64_t offset; /* file offset of the block */
+	uint32_t size;	 /* its size in the file; stored if the uncompressed size */
+	uint32_t unused;
+} dbzentry_t;
+
+typedef struct dbzfile {
+	struct dbzfile *next;
+	int				fd;
+	FILE		   *stream;	  /* when opened by dbzfopen() */
+	long			length;	  /* uncompressed length */
+	long			nblocks;  /* number of blocks */
+	dbzentry_t	   *table;	  /* where the blocks are */
+	long			position; /* database offset of the next read */
+	long			cached;	  /* block in buf, or -1 */
+	char		   *buf;	  /* uncompressed block */
+	unsigned char  *zbuf;	  /* compressed block */
+} dbzfile_t;
+
+bool blockcompress = false; /* write block-compressed databases */
+
+/* the database being written */
+static int			  zfd = -1;
+static char			 *zfirst;		/* first block, written last */
+static size_t		  zfirstlen;	/* bytes in it */
+static char			 *zblock;		/* any later block being filled */
+static char			 *zcur;			/* block being filled */
+static size_t		  zfill;		/* bytes in it */
+static long			  zlength;		/* uncompressed bytes written */
+static long			  zrewound;		/* offset in the first block after dbzrewind(), or -1 */
+static dbzentry_t	 *ztable;		/* where the blocks went */
+static long			  zblocks;		/* number of complete blocks */
+static long			  zmaxblocks;	/* size of ztable */
+static off_t		  zoffset;		/* file offset of the next block */
+static unsigned char *zout;			/* compressed block */
+
+/* databases being read */
+static dbzfile_t *dbzfiles;
+
+static bool		  putblock(const char *data, size_t len, long index);
+static dbzfile_t *dbzattach(int fd);
+static dbzfile_t *dbzfind(int fd);
+static bool		  loadblock(dbzfile_t *z, long n);
+static ssize_t	  readfile(dbzfile_t *z, char *buf, size_t n);
+
+static inline
+uint32_t read32(const unsigned char *p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline
+unsigned char *putlength(unsigned char *op, size_t len) {
+	for(; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+/* compress n bytes (at most 64K) with a byte aligned LZ77 coding;
+ * every sequence is a token of 4 bit literal and match lengths,
+ * the literals, a 16 bit match offset and any longer lengths.
+ * Returns the compressed size, or 0 if it would exceed cap */
+size_t lzcompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+	uint16_t			 table[1 << LZHASHBITS];
+	const unsigned char *anchor = src;
+	const unsigned char *ip		= src;
+	const unsigned char *end	= src + n;
+	unsigned char		*op		= dst;
+
+	memset(table, 0, sizeof(table));
+	if(n > LZMFLIMIT) {
+		const unsigned char *limit = end - LZMFLIMIT;
+
+		while(ip < limit) {
+			uint32_t			 v = read32(ip);
+			unsigned			 h = (v * 2654435761u) >> (32 - LZHASHBITS);
+			const unsigned char *match = src + table[h];
+			size_t				 litlen, matchlen;
+
+			table[h] = (uint16_t)(ip - src);
+			if(match >= ip || read32(match) != v) {
+				/* skip faster through data that does not compress */
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			/* extend the match both ways */
+			while(ip > anchor && match > src && ip[-1] == match[-1]) {
+				--ip;
+				--match;
+			}
+			matchlen = LZMINMATCH;
+			while(ip + matchlen < end - LZLASTLITS && ip[matchlen] == match[matchlen]) {
+				++matchlen;
+			}
+			litlen = ip - anchor;
+			if((size_t)(op - dst) + 1 + litlen + litlen / 255 + 2 + matchlen / 255 + 2 > cap) { return 0; }
+
+			/* output the sequence */
+			unsigned char *token = op++;
+			*token = (unsigned char)((litlen < 15 ? litlen : 15) << 4);
+			if(litlen >= 15) { op = putlength(op, litlen - 15); }
+			memcpy(op, anchor, litlen);
+			op += litlen;
+			*op++ = (unsigned char)(ip - match);
+			*op++ = (unsigned char)((ip - match) >> 8);
+			*token |= (unsigned char)(matchlen - LZMINMATCH < 15 ? matchlen - LZMINMATCH : 15);
+			if(matchlen - LZMINMATCH >= 15) { op = putlength(op, matchlen - LZMINMATCH - 15); }
+
+			ip += matchlen;
+			anchor = ip;
+		}
+	}
+	/* the last literals end the block */
+	size_t litlen = end - anchor;
+	if((size_t)(op - dst) + 1 + litlen + litlen / 255 + 1 > cap) { return 0; }
+	*op++ = (unsigned char)((litlen < 15 ? litlen : 15) << 4);
+	if(litlen >= 15) { op = putlength(op, litlen - 15); }
+	memcpy(op, anchor, litlen);
+	op += litlen;
+	return op - dst;
+}
+
+/* decompress what lzcompress() made, checking every length against
+ * both buffers; returns the uncompressed size, or -1 if it is corrupt */
+long lzdecompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+	const unsigned char *ip	  = src;
+	const unsigned char *iend = src + n;
+	unsigned char		*op	  = dst;
+	unsigned char		*oend = dst + cap;
+
+	while(ip < iend) {
+		unsigned token = *ip++;
+		size_t	 len   = token >> 4;
+		size_t	 offset;
+
+		if(len == 15) {
+			unsigned b;
+			do {
+				if(ip == iend) { return -1; }
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		if(len > (size_t)(iend - ip) || len > (size_t)(oend - op)) { return -1; }
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		if(ip == iend) { break; } /* the last literals */
+
+		if(iend - ip < 2) { return -1; }
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > (size_t)(op - dst)) { return -1; }
+		len = token & 15;
+		if(len == 15) {
+			unsigned b;
+			do {
+				if(ip == iend) { return -1; }
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		len += LZMINMATCH;
+		if(len > (size_t)(oend - op)) { return -1; }
+		if(offset >= len) {
+			memcpy(op, op - offset, len);
+			op += len;
+		} else { /* the match overlaps its own output */
+			for(; len > 0; --len, ++op) {
+				*op = op[-offset];
+			}
+		}
+	}
+	return op - dst;
+}
+
+/* compress a block and write it at the end of the file */
+static
+bool putblock(const char *data, size_t len, long index) {
+	size_t size = lzcompress((const unsigned char *)data, len, zout, len > 0 ? len - 1 : 0);
+	const void *out = zout;
+
+	if(size == 0) { /* store it */
+		size = len;
+		out	 = data;
+	}
+	if(index >= zmaxblocks) {
+		dbzentry_t *p;
+
+		zmaxblocks = zmaxblocks == 0 ? DBZTABLEINIT : zmaxblocks * 2;
+		if((p = realloc(ztable, zmaxblocks * sizeof(*ztable))) == NULL) { return false; }
+		ztable = p;
+	}
+	if(size > 0 && pwrite(zfd, out, size, zoffset) != (ssize_t)size) { return false; }
+	ztable[index].offset = zoffset;
+	ztable[index].size	 = size;
+	ztable[index].unused = 0;
+	zoffset += size;
+	return true;
+}
+
+/* start writing a block-compressed database to the file */
+bool dbzcreate(int fd) {
+	if(zfirst == NULL) {
+		zfirst = malloc(DBBLOCKSIZE);
+		zblock = malloc(DBBLOCKSIZE);
+		zout   = malloc(DBBLOCKSIZE);
+		if(zfirst == NULL || zblock == NULL || zout == NULL) { return false; }
+	}
+	zfd		  = fd;
+	zcur	  = zfirst;
+	zfill	  = 0;
+	zfirstlen = 0;
+	zlength	  = 0;
+	zrewound  = -1;
+	zblocks	  = 0;
+	zoffset	  = DBZHEADERSIZE; /* the header is written last */
+	return true;
+}
+
+/* output n bytes of the database */
+bool dbzwrite(const char *s, size_t n) {
+	if(zrewound >= 0) {
+		/* only the header is rewritten */
+		if(zrewound + n > zfirstlen) { return false; }
+		memcpy(zfirst + zrewound, s, n);
+		zrewound += n;
+		return true;
+	}
+	while(n > 0) {
+		size_t k = DBBLOCKSIZE - zfill < n ? DBBLOCKSIZE - zfill : n;
+
+		memcpy(zcur + zfill, s, k);
+		zfill += k;
+		zlength += k;
+		s += k;
+		n -= k;
+		if(zcur == zfirst) { zfirstlen = zfill; }
+		if(zfill == DBBLOCKSIZE) {
+			if(zcur == zfirst) {
+				zcur = zblock; /* keep the first block */
+			} else if(putblock(zblock, zfill, zblocks) == false) {
+				return false;
+			}
+			++zblocks;
+			zfill = 0;
+		}
+	}
+	return true;
+}
+
+/* overwrite the database from its start */
+void dbzrewind(void) {
+	zrewound = 0;
+}
+
+/* write the rest of the database, the block table and the header */
+bool dbzfinish(void) {
+	dbzheader_t header;
+	size_t		tablesize;
+
+	if(zcur == zfirst) {
+		zblocks = 1;
+	} else if(zfill > 0 && putblock(zblock, zfill, zblocks++) == false) {
+		return false;
+	}
+	if(putblock(zfirst, zfirstlen, 0) == false) { return false; }
+
+	tablesize = zblocks * sizeof(*ztable);
+	if(pwrite(zfd, ztable, tablesize, zoffset) != (ssize_t)tablesize) { return false; }
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magicpad, DBZMAGIC, DBZMAGICLEN);
+	header.blocksize = DBBLOCKSIZE;
+	header.version	 = DBZVERSION;
+	header.length	 = zlength;
+	header.table	 = zoffset;
+	if(pwrite(zfd, &header, sizeof(header), 0) != sizeof(header)) { return false; }
+	zfd = -1;
+	return true;
+}
+
+/* find out if the file is block-compressed and if so prepare to read it;
+ * returns NULL for a plain file, with errno set if it is corrupt */
+static
+dbzfile_t *dbzattach(int fd) {
+	dbzheader_t header;
+	dbzfile_t  *z;
+	struct stat st;
+	size_t		tablesize;
+
+	errno = 0;
+	if(pread(fd, &header, sizeof(header), 0) != sizeof(header)
+	|| memcmp(header.magicpad, DBZMAGIC, DBZMAGICLEN) != 0) {
+		return NULL;
+	}
+	if(header.version != DBZVERSION || header.blocksize != DBBLOCKSIZE || fstat(fd, &st) == -1) {
+		errno = EINVAL;
+		return NULL;
+	}
+	z		   = calloc(1, sizeof(*z));
+	z->fd	   = fd;
+	z->length  = header.length;
+	z->nblocks = (header.length + DBBLOCKSIZE - 1) / DBBLOCKSIZE;
+	if(z->nblocks == 0) { z->nblocks = 1; }
+	tablesize = z->nblocks * sizeof(*z->table);
+	z->table  = malloc(tablesize);
+	z->buf	  = malloc(DBBLOCKSIZE);
+	z->zbuf	  = malloc(DBBLOCKSIZE);
+	z->cached = -1;
+	if(header.table + tablesize > (uint64_t)st.st_size
+	|| pread(fd, z->table, tablesize, header.table) != (ssize_t)tablesize) {
+		free(z->table);
+		free(z->buf);
+		free(z->zbuf);
+		free(z);
+		errno = EINVAL;
+		return NULL;
+	}
+	z->next	 = dbzfiles;
+	dbzfiles = z;
+	return z;
+}
+
+static
+dbzfile_t *dbzfind(int fd) {
+	for(dbzfile_t *z = dbzfiles; z != NULL; z = z->next) {
+		if(z->fd == fd) { return z; }
+	}
+	return NULL;
+}
+
+/* open a database of either format for dbzread() */
+int dbzopen(const char *path) {
+	int fd = vpopen(path, O_BINARY | O_RDONLY);
+
+	if(fd != -1 && dbzattach(fd) == NULL && errno != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* uncompress block n into the cache */
+static
+bool loadblock(dbzfile_t *z, long n) {
+	dbzentry_t *e	= &z->table[n];
+	long		len = (n == z->nblocks - 1) ? z->length - n * DBBLOCKSIZE : DBBLOCKSIZE;
+
+	if(z->cached == n) { return true; }
+	z->cached = -1;
+	if(e->size == len) { /* stored */
+		if(pread(z->fd, z->buf, len, e->offset) != len) { return false; }
+	} else if(e->size > DBBLOCKSIZE
+	|| pread(z->fd, z->zbuf, e->size, e->offset) != (ssize_t)e->size
+	|| lzdecompress(z->zbuf, e->size, (unsigned char *)z->buf, DBBLOCKSIZE) != len) {
+		return false;
+	}
+	z->cached = n;
+	return true;
+}
+
+/* read like read(2), from the uncompressed database */
+static
+ssize_t readfile(dbzfile_t *z, char *buf, size_t n) {
+	size_t done = 0;
+
+	while(done < n && z->position < z->length) {
+		long   block  = z->position / DBBLOCKSIZE;
+		long   offset = z->position % DBBLOCKSIZE;
+		long   len	  = (block == z->nblocks - 1) ? z->length - block * DBBLOCKSIZE : DBBLOCKSIZE;
+		size_t k	  = len - offset < (long)(n - done) ? (size_t)(len - offset) : n - done;
+
+		if(loadblock(z, block) == false) {
+			errno = EIO;
+			return -1;
+		}
+		memcpy(buf + done, z->buf + offset, k);
+		done += k;
+		z->position += k;
+	}
+	return done;
+}
+
+ssize_t dbzread(int fd, char *buf, size_t n) {
+	dbzfile_t *z = dbzfind(fd);
+
+	return z == NULL ? read(fd, buf, n) : readfile(z, buf, n);
+}
+
+/* seek to a database offset */
+off_t dbzlseek(int fd, off_t offset) {
+	dbzfile_t *z = dbzfind(fd);
+
+	if(z == NULL) { return lseek(fd, offset, SEEK_SET); }
+	if(offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	z->position = offset;
+	return offset;
+}
+
+/* close a database opened by dbzopen() */
+int dbzclose(int fd) {
+	for(dbzfile_t **p = &dbzfiles; *p != NULL; p = &(*p)->next) {
+		dbzfile_t *z = *p;
+
+		if(z->fd == fd) {
+			*p = z->next;
+			free(z->table);
+			free(z->buf);
+			free(z->zbuf);
+			free(z);
+			break;
+		}
+	}
+	return close(fd);
+}
+
+static
+ssize_t cookieread(void *cookie, char *buf, size_t n) {
+	return readfile(cookie, buf, n);
+}
+
+static
+int cookieseek(void *cookie, off64_t *offset, int whence) {
+	dbzfile_t *z = cookie;
+	off64_t	   position;
+
+	switch(whence) {
+		case SEEK_SET:
+			position = *offset;
+			break;
+		case SEEK_CUR:
+			position = z->position + *offset;
+			break;
+		case SEEK_END:
+			position = z->length + *offset;
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+	if(position < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	z->position = position;
+	*offset		= position;
+	return 0;
+}
+
+static
+int cookieclose(void *cookie) {
+	return dbzclose(((dbzfile_t *)cookie)->fd);
+}
+
+/* open a database of either format for stdio reads */
+FILE *dbzfopen(const char *path) {
+	static const cookie_io_functions_t io = { cookieread, NULL, cookieseek, cookieclose };
+	dbzfile_t *z;
+	FILE	  *f;
+	int		   fd;
+
+	if((fd = vpopen(path, O_BINARY | O_RDONLY)) == -1) { return NULL; }
+	if((z = dbzattach(fd)) == NULL) {
+		if(errno != 0 || (f = fdopen(fd, "rb")) == NULL) {
+			close(fd);
+			return NULL;
+		}
+		return f;
+	}
+	if((f = fopencookie(z, "rb", io)) == NULL) {
+		dbzclose(fd);
+		return NULL;
+	}
+	z->stream = f;
+	return f;
+}
+
+static
+dbzfile_t *dbzstream(FILE *f) {
+	for(dbzfile_t *z = dbzfiles; z != NULL; z = z->next) {
+		if(z->stream == f) { return z; }
+	}
+	return NULL;
+}
+
+/* fstat(2) the file of a database opened by dbzfopen() */
+int dbzfstat(FILE *f, struct stat *st) {
+	dbzfile_t *z = dbzstream(f);
+
+	return fstat(z != NULL ? z->fd : fileno(f), st);
+}
+
+/* is a database opened by dbzfopen() block-compressed */
+bool dbzcompressed(FILE *f) {
+	return dbzstream(f) != NULL;
+}
+
+/* can a database opened by dbzopen() be mapped as it is, being plain */
+bool dbzmappable(int fd) {
+	return dbzfind(fd) == NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef DBBLOCK_H
+#define DBBLOCK_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define DBBLOCKSIZE	 (64 * 1024) /* uncompressed size of a database block */
+#define DBZHEADERSIZE 32		 /* size of the block-compressed file header */
+
+extern bool blockcompress; /* write block-compressed databases */
+
+/* writing, through dbwrite.c */
+bool dbzcreate(int fd);
+bool dbzwrite(const char *s, size_t n);
+void dbzrewind(void);
+bool dbzfinish(void);
+
+/* reading, either format */
+int		dbzopen(const char *path);
+FILE   *dbzfopen(const char *path);
+ssize_t dbzread(int fd, char *buf, size_t n);
+off_t	dbzlseek(int fd, off_t offset);
+int		dbzclose(int fd);
+int		dbzfstat(FILE *f, struct stat *st);
+bool	dbzcompressed(FILE *f);
+bool	dbzmappable(int fd);
+
+/* the in-tree block codec */
+size_t lzcompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+long   lzdecompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+#endif
@@ -0,0 +1,176 @@
+#include "global.h"
+#include "dbwrite.h"
+
+#include <errno.h>
+#include <sys/uio.h>
+
+/* The new database is written through one large aligned buffer,
+ *  which goes to the file with write(2) when it is full.
+ * Output larger than the buffer is written with the buffer
+ *  by one writev(2) instead of being copied into it.
+ * The database offset is the buffer's file offset
+ *  plus the number of bytes in it, so it needs no updating.
+ * A block-compressed database gets the same output through dbzwrite().
+ */
+
+char *dbbuf;	 /* output buffer */
+char *dbbufp;	 /* next free byte of the output buffer */
+char *dbbufend;	 /* end of the output buffer */
+long  dbflushed; /* database offset of the output buffer */
+
+static int	dbfd = -1;			 /* database file */
+static bool dbz;				 /* the database is block-compressed */
+static char dbpath[PATHLEN + 1]; /* database file name for write errors */
+
+static void dbwritev(struct iovec *iov, int iovcnt);
+
+/* write all of the vector to the database file */
+static
+void dbwritev(struct iovec *iov, int iovcnt) {
+	if(dbz == true) {
+		for(; iovcnt > 0; ++iov, --iovcnt) {
+			if(dbzwrite(iov->iov_base, iov->iov_len) == false) {
+				cannotwrite(dbpath);
+				/* NOTREACHED */
+			}
+			dbflushed += iov->iov_len;
+		}
+		return;
+	}
+	while(iovcnt > 0) {
+		ssize_t n;
+
+		if((n = writev(dbfd, iov, iovcnt)) == -1) {
+			if(errno == EINTR) { continue; }
+			cannotwrite(dbpath);
+			/* NOTREACHED */
+		}
+		dbflushed += n;
+		for(; iovcnt > 0 && (size_t)n >= iov->iov_len; ++iov, --iovcnt) {
+			n -= iov->iov_len;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+/* create the database file, whose offset starts at 0 */
+bool dbcreate(const char *path) {
+	if(dbbuf == NULL) {
+		void *p;
+
+		if(posix_memalign(&p, DBBUFALIGN, DBBUFSIZE) != 0) { return false; }
+		dbbuf	 = p;
+		dbbufend = dbbuf + DBBUFSIZE;
+	}
+	snprintf(dbpath, sizeof(dbpath), "%s", path);
+	if((dbfd = myopen(path, O_BINARY | O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) { return false; }
+	if((dbz = blockcompress) == true && dbzcreate(dbfd) == false) {
+		close(dbfd);
+		return false;
+	}
+	dbbufp	  = dbbuf;
+	dbflushed = 0;
+	return true;
+}
+
+/* write the buffered output */
+void dbflush(void) {
+	struct iovec iov;
+
+	iov.iov_base = dbbuf;
+	iov.iov_len	 = dbbufp - dbbuf;
+	dbwritev(&iov, 1);
+	dbbufp = dbbuf;
+}
+
+/* output n bytes */
+void dbwrite(const char *s, size_t n) {
+	struct iovec iov[2];
+
+	if(n <= (size_t)(dbbufend - dbbufp)) {
+		memcpy(dbbufp, s, n);
+		dbbufp += n;
+		return;
+	}
+	if(n < DBBUFSIZE / 2) {
+		size_t first = dbbufend - dbbufp;
+
+		/* fill up the buffer */
+		memcpy(dbbufp, s, first);
+		dbbufp = dbbufend;
+		dbflush();
+		memcpy(dbbufp, s + first, n - first);
+		dbbufp += n - first;
+		return;
+	}
+	iov[0].iov_base = dbbuf;
+	iov[0].iov_len	= dbbufp - dbbuf;
+	iov[1].iov_base = (char *)s;
+	iov[1].iov_len	= n;
+	dbwritev(iov, 2);
+	dbbufp = dbbuf;
+}
+
+/* make room for up to n bytes of output (at most DBBUFSIZE),
+ * which the caller stores at the returned pointer and then sets dbbufp past */
+char *dbreserve(size_t n) {
+	if(n > (size_t)(dbbufend - dbbufp)) { dbflush(); }
+	return dbbufp;
+}
+
+/* output formatted text */
+void dbprintf(const char *format, ...) {
+	va_list ap;
+	int		n;
+
+	va_start(ap, format);
+	n = vsnprintf(dbbufp, dbbufend - dbbufp, format, ap);
+	va_end(ap);
+	if(n < 0) {
+		cannotwrite(dbpath);
+		/* NOTREACHED */
+	}
+	if(n >= dbbufend - dbbufp) {
+		/* it did not fit */
+		dbflush();
+		if(n >= DBBUFSIZE) {
+			char *s = malloc(n + 1);
+
+			va_start(ap, format);
+			vsnprintf(s, n + 1, format, ap);
+			va_end(ap);
+			dbwrite(s, n);
+			free(s);
+			return;
+		}
+		va_start(ap, format);
+		vsnprintf(dbbufp, dbbufend - dbbufp, format, ap);
+		va_end(ap);
+	}
+	dbbufp += n;
+}
+
+/* go back to the start of the database to overwrite it */
+void dbrewind(void) {
+	dbflush();
+	if(dbz == true) {
+		dbzrewind();
+	} else if(lseek(dbfd, 0, SEEK_SET) == -1) {
+		cannotwrite(dbpath);
+		/* NOTREACHED */
+	}
+	dbflushed = 0;
+}
+
+/* write the buffered output and close the database file */
+void dbclose(void) {
+	dbflush();
+	if((dbz == true && dbzfinish() == false) || close(dbfd) == -1) {
+		cannotwrite(dbpath);
+		/* NOTREACHED */
+	}
+	dbfd = -1;
+}
@@ -0,0 +1,32 @@
+#ifndef DBWRITE_H
+#define DBWRITE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "dbblock.h"
+
+#define DBBUFSIZE  (256 * 1024) /* database output buffer size */
+#define DBBUFALIGN 4096			/* database output buffer alignment */
+
+/* the database is written through a buffer that knows its offset */
+extern char *dbbuf;		/* output buffer */
+extern char *dbbufp;	/* next free byte of the output buffer */
+extern char *dbbufend;	/* end of the output buffer */
+extern long	 dbflushed; /* database offset of the output buffer */
+
+/* database output macros that update its offset */
+#define dboffset   (dbflushed + (long)(dbbufp - dbbuf))
+#define dbputc(c)  ((dbbufp == dbbufend ? dbflush() : (void)0), (void)(*dbbufp++ = (char)(c)))
+#define dbfputs(s) dbwrite((s), strlen(s))
+
+bool dbcreate(const char *path);
+void dbflush(void);
+void dbwrite(const char *s, size_t n);
+char *dbreserve(size_t n);
+void dbprintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void dbrewind(void);
+void dbclose(void);
+
+#endif
@@ -0,0 +1,207 @@
+#include "global.h"
+#include "build.h"
+#include "digraph.h"
+
+/* Text in the database is compressed by coding a pair of characters,
+ *  one of DICHAR1 first and one of DICHAR2 second characters,
+ *  as a single byte with the high bit set.
+ * The pairs a code base uses most depend on its language and style,
+ *  so a new database gets a table chosen from a sample of its source files,
+ *  which is stored in its header as the -D option.
+ * Databases without one use the table of the original cscope.
+ */
+
+/* note: these digraph character frequencies were calculated from possible
+   printable digraphs in the cross-reference for the C compiler */
+static const char defaultdichar1[] = " teisaprnl(of)=c";
+static const char defaultdichar2[] = " tnerpla";
+
+char dichar1[DICHAR1 + 1] = " teisaprnl(of)=c"; /* 16 most frequent first chars */
+char dichar2[DICHAR2 + 1] = " tnerpla";			 /* 8 most frequent second chars
+													using the above as first chars */
+char dicode1[256]; /* digraph first character code */
+char dicode2[256]; /* digraph second character code */
+
+/* check_for_assignment() in find.c must see these characters
+ * after a blank or a symbol, so they cannot be second characters */
+static const char notsecond[] = "=+-*/%&|^<>";
+
+static bool digraphfirst(int c);
+static bool digraphsecond(int c);
+static void pickdigraphs(const unsigned long *score, bool (*allowed)(int), char *chars, int have, int want, const char *fill);
+
+static
+bool digraphfirst(int c) {
+	return c >= ' ' && c <= '~';
+}
+
+static
+bool digraphsecond(int c) {
+	return digraphfirst(c) && strchr(notsecond, c) == NULL;
+}
+
+/* set up the digraph character tables for text compression */
+void initcompress(void) {
+	memset(dicode1, 0, sizeof(dicode1));
+	memset(dicode2, 0, sizeof(dicode2));
+	if(compress == true) {
+		for(int i = 0; i < DICHAR1; i++) {
+			dicode1[(unsigned char)(dichar1[i])] = i * 8 + 1;
+		}
+		for(int i = 0; i < DICHAR2; i++) {
+			dicode2[(unsigned char)(dichar2[i])] = i + 1;
+		}
+	}
+}
+
+/* use the table of databases without a -D option */
+void defaultdigraphs(void) {
+	strcpy(dichar1, defaultdichar1);
+	strcpy(dichar2, defaultdichar2);
+}
+
+/* append the allowed characters of the highest scores to chars[0 .. have],
+ * then any of fill and any other allowed characters until there are want */
+static
+void pickdigraphs(const unsigned long *score, bool (*allowed)(int), char *chars, int have, int want, const char *fill) {
+	chars[have] = '\0';
+	while(have < want) {
+		int best = -1;
+
+		for(int c = ' '; c <= '~'; ++c) {
+			if(score[c] > 0 && allowed(c) == true && strchr(chars, c) == NULL
+			&& (best == -1 || score[c] > score[best])) {
+				best = c;
+			}
+		}
+		if(best == -1) { break; }
+		chars[have++] = best;
+		chars[have]	  = '\0';
+	}
+	for(const char *s = fill; have < want && *s != '\0'; ++s) {
+		if(allowed(*s) == true && strchr(chars, *s) == NULL) {
+			chars[have++] = *s;
+			chars[have]	  = '\0';
+		}
+	}
+	for(int c = ' '; have < want && c <= '~'; ++c) {
+		if(allowed(c) == true && strchr(chars, c) == NULL) {
+			chars[have++] = c;
+			chars[have]	  = '\0';
+		}
+	}
+}
+
+/* choose the digraph table for the source files */
+void traindigraphs(void) {
+	unsigned long (*pairs)[128];
+	unsigned long score[128];
+	unsigned long step;
+	unsigned long total = 0;
+	char		 *buf;
+
+	defaultdigraphs();
+	if(compress == false || nsrcfiles == 0) { return; }
+
+	/* count the printable pairs in a sample spread over the source files,
+	 * with blanks squeezed as the scanner does */
+	pairs = calloc(128, sizeof(*pairs));
+	buf	  = malloc(DIGRAPHSAMPLE);
+	step  = (nsrcfiles + DIGRAPHFILES - 1) / DIGRAPHFILES;
+	for(unsigned long i = 0; i < nsrcfiles; i += step) {
+		ssize_t n;
+		int		fd;
+		int		prev = -1;
+
+		if((fd = myopen(srcfiles[i], O_BINARY | O_RDONLY, 0)) == -1) { continue; }
+		n = read(fd, buf, DIGRAPHSAMPLE);
+		close(fd);
+		for(ssize_t k = 0; k < n; ++k) {
+			int c = (unsigned char)buf[k];
+
+			if(c == '\t') { c = ' '; }
+			if(c == ' ' && prev == ' ') { continue; }
+			if(digraphfirst(c) == false) {
+				prev = -1;
+				continue;
+			}
+			if(prev != -1) {
+				++pairs[prev][c];
+				++total;
+			}
+			prev = c;
+		}
+	}
+	free(buf);
+	if(total == 0) {
+		free(pairs);
+		return;
+	}
+
+	/* alternately choose the best first characters for the second ones
+	 * and the other way round, starting from the most frequent seconds */
+	memset(score, 0, sizeof(score));
+	for(int c1 = ' '; c1 <= '~'; ++c1) {
+		for(int c2 = ' '; c2 <= '~'; ++c2) {
+			score[c2] += pairs[c1][c2];
+		}
+	}
+	pickdigraphs(score, digraphsecond, dichar2, 0, DICHAR2, defaultdichar2);
+	for(int pass = 0; pass < 4; ++pass) {
+		memset(score, 0, sizeof(score));
+		for(int c1 = ' '; c1 <= '~'; ++c1) {
+			for(int j = 0; j < DICHAR2; ++j) {
+				score[c1] += pairs[c1][(unsigned char)dichar2[j]];
+			}
+		}
+		/* compressing blanks relies on the blank being a first character */
+		dichar1[0] = ' ';
+		pickdigraphs(score, digraphfirst, dichar1, 1, DICHAR1, defaultdichar1);
+
+		memset(score, 0, sizeof(score));
+		for(int j = 0; j < DICHAR1; ++j) {
+			for(int c2 = ' '; c2 <= '~'; ++c2) {
+				score[c2] += pairs[(unsigned char)dichar1[j]][c2];
+			}
+		}
+		pickdigraphs(score, digraphsecond, dichar2, 0, DICHAR2, defaultdichar2);
+	}
+	free(pairs);
+}
+
+/* put the -D option with the digraph table into the database header */
+void putdigraphs(void) {
+	dbfputs(" -D");
+	for(int i = 0; i < DICHAR1; ++i) {
+		dbprintf("%02x", (unsigned char)dichar1[i]);
+	}
+	for(int i = 0; i < DICHAR2; ++i) {
+		dbprintf("%02x", (unsigned char)dichar2[i]);
+	}
+}
+
+/* read the digraph table after a -D option in a database header */
+bool readdigraphs(FILE *f) {
+	char	 first[DICHAR1 + 1];
+	char	 second[DICHAR2 + 1];
+	unsigned c;
+
+	memset(first, 0, sizeof(first));
+	memset(second, 0, sizeof(second));
+	for(int i = 0; i < DICHAR1; ++i) {
+		if(fscanf(f, "%2x", &c) != 1 || digraphfirst(c) == false || strchr(first, c) != NULL) {
+			return false;
+		}
+		first[i] = c;
+	}
+	for(int i = 0; i < DICHAR2; ++i) {
+		if(fscanf(f, "%2x", &c) != 1 || digraphsecond(c) == false || strchr(second, c) != NULL) {
+			return false;
+		}
+		second[i] = c;
+	}
+	if(strchr(first, ' ') == NULL) { return false; }
+	strcpy(dichar1, first);
+	strcpy(dichar2, second);
+	return true;
+}
@@ -0,0 +1,18 @@
+#ifndef DIGRAPH_H
+#define DIGRAPH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define DICHAR1		  16	   /* digraph first characters */
+#define DICHAR2		  8		   /* digraph second characters */
+#define DIGRAPHFILES  128	   /* source files sampled for the digraph table */
+#define DIGRAPHSAMPLE (32 * 1024) /* bytes sampled from each of them */
+
+void initcompress(void);
+void defaultdigraphs(void);
+void traindigraphs(void);
+void putdigraphs(void);
+bool readdigraphs(FILE *f);
+
+#endif
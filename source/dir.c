@@ -38,6 +38,8 @@
 
 #include "global.h"
 
+#include "build.h"
+#include "buildstats.h"
 #include "vpath.h" /* vpdirs and vpndirs */
 
 #include <stdlib.h>
@@ -45,12 +47,14 @@
 #include <dirent.h>
 #include <sys/stat.h>  /* stat */
 #include <assert.h>
+#include <pthread.h>
 
 #define DIRSEPS " ,:"				   /* directory list separators */
 #define DIRINC	10					   /* directory list size increment */
-#define HASHMOD 2003				   /* must be a prime number */
-#define SRCINC	HASHMOD				   /* source file list size increment */
-									   /* largest known database had 22049 files */
+#define SCANTHREADS 8				   /* directory scanning threads */
+#define SRCINC	2048				   /* minimum source file list size increment */
+#define SRCNAMEINIT 4096			   /* initial source file registry size, a power of 2 */
+#define INCCACHEINIT 1024			   /* initial #include cache size, a power of 2 */
 
 char		  currentdir[PATHLEN + 1]; /* current directory */
 char		**incdirs;				   /* #include directories */
@@ -60,6 +64,7 @@ unsigned long nincdirs;				   /* number of #include directories */
 unsigned long nsrcdirs;				   /* number of source directories */
 unsigned long nsrcfiles;			   /* number of source files */
 unsigned long msrcfiles = SRCINC;	   /* maximum number of source files */
+bool		  includecache;			   /* keep the #include cache in the database */
 
 static bool firstbuild = true;
 
@@ -68,16 +73,74 @@ static unsigned long mincdirs = DIRINC; /* maximum number of #include directorie
 static unsigned long msrcdirs;			/* maximum number of source directories */
 static unsigned long nvpsrcdirs;		/* number of view path source directories */
 
-static struct listitem {				/* source file names without view pathing */
-		char			*text;
-		struct listitem *next;
-} *srcnames[HASHMOD];
+typedef struct {						/* source file registry slot */
+		const char	 *name;				/* source file name in srcfiles, or NULL */
+		unsigned long hash;				/* hash of the name */
+} srcname_t;
+
+/* source file names without view pathing, by open addressing */
+static srcname_t	*srcnames;			/* source file registry */
+static unsigned long msrcnames;			/* registry size, a power of 2 */
+static unsigned long nsrcnames;			/* number of registered names */
+
+typedef struct scannode {				/* directory being scanned */
+		char			*path;			/* directory path */
+		struct scanitem *items;			/* source files and subdirectories */
+		size_t			 nitems;		/* number of items */
+		size_t			 mitems;		/* maximum number of items */
+} scannode_t;
+
+typedef struct scanitem {				/* directory entry, one of: */
+		char			*file;			/* source file path */
+		struct scannode *dir;			/* subdirectory */
+} scanitem_t;
+
+static bool			   scanrecurse;	/* scan subdirectories */
+/* #include file resolutions for the build, so that the #include
+ * directories are only searched once for each file name;
+ * they only depend on the file system, not on the source file list */
+typedef struct {						/* #include resolution */
+		char		 *name;				/* included file name, or NULL */
+		unsigned long hash;				/* hash of the quote and name */
+		char		  quote;			/* '"' or '<' */
+		int			  viewpath;			/* "file" in the view path: 0 as is, else srcdirs index; or -1 */
+		int			  incdir;			/* incdirs index of the file, or -1 */
+} incresolve_t;
+
+static incresolve_t *inccache;			/* #include resolution cache */
+static unsigned long minccache;			/* cache size, a power of 2 */
+static unsigned long ninccache;			/* number of cached resolutions */
+
+static scannode_t	 **scanqueue;	/* directories waiting to be scanned */
+static size_t		   nscanqueue;	/* number of waiting directories */
+static size_t		   mscanqueue;	/* maximum number of waiting directories */
+static int			   scanbusy;	/* threads scanning a directory */
+static pthread_mutex_t scanlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  scancond = PTHREAD_COND_INITIALIZER;
 
 /* Internal prototypes: */
 static bool is_accessible_file(const char *file);
-static bool is_source_file(char *file);
 static void add_source_directory(char *dir);
 static void add_include_directory(char *name, char *path);
+static bool is_source_name(const char *file);
+static unsigned long hash_srcname(const char *name);
+static srcname_t *find_srcname(const char *name, unsigned long h);
+static void grow_srcnames(void);
+static int viewpath_index(const char *file);
+static void viewpath_name(char *path, const char *file, int i);
+static unsigned long hash_include(const char *file, char quote);
+static incresolve_t *find_include(const char *file, char quote, unsigned long h);
+static incresolve_t *cache_include(const char *file, char quote, int viewpath, int incdir);
+static incresolve_t *resolve_include(const char *file, char quote);
+static void add_probed(char ***paths, size_t *npaths, size_t *mpaths, const char *path);
+static char *probed_dir(const char *path);
+static int compare_dirs(const void *s1, const void *s2);
+static size_t sort_unique(char **paths, size_t npaths);
+static void scan_push(scannode_t *node);
+static void scan_item(scannode_t *node, char *file, scannode_t *dir);
+static void scan_node(scannode_t *node);
+static void *scan_worker(void *arg);
+static void scan_add(scannode_t *node);
 static void scan_dir(const char *dirfile, bool recurse);
 static void make_vp_source_directories(void);
 static void read_listfile(FILE * listfile);
@@ -312,44 +375,146 @@ void add_include_directory(char *name, char *path) {
 	}
 }
 
-/* scan a directory (recursively?) for source files */
+/* queue a directory to be scanned */
 static
-void scan_dir(const char *adir, bool recurse_dir) {
-	DIR *dirfile;
-	int	 adir_len = strlen(adir);
+void scan_push(scannode_t *node) {
+	pthread_mutex_lock(&scanlock);
+	if(nscanqueue == mscanqueue) {
+		mscanqueue += DIRINC;
+		scanqueue = realloc(scanqueue, mscanqueue * sizeof(*scanqueue));
+	}
+	scanqueue[nscanqueue++] = node;
+	pthread_cond_signal(&scancond);
+	pthread_mutex_unlock(&scanlock);
+}
 
-	/* FIXME: no guards against adir_len > PATHLEN, yet */
+/* add a source file or subdirectory to a scanned directory */
+static
+void scan_item(scannode_t *node, char *file, scannode_t *dir) {
+	if(node->nitems == node->mitems) {
+		node->mitems += DIRINC;
+		node->items = realloc(node->items, node->mitems * sizeof(*node->items));
+	}
+	node->items[node->nitems].file	= file;
+	node->items[node->nitems++].dir = dir;
+}
 
-	if((dirfile = opendir(adir)) != NULL) {
-		struct dirent *entry;
-		char		   path[PATHLEN + 1];
+/* scan a directory for source files and queue its subdirectories;
+ * d_type saves a stat of most entries, and the rest are looked at
+ * relative to the directory */
+static
+void scan_node(scannode_t *node) {
+	DIR			  *dirfile;
+	struct dirent *entry;
+	int			   fd;
+	int			   path_len = strlen(node->path);
+
+	if((fd = open(node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) { return; }
+	if((dirfile = fdopendir(fd)) == NULL) {
+		close(fd);
+		return;
+	}
+	while((entry = readdir(dirfile)) != NULL) {
+		char		path[PATHLEN + 1];
+		struct stat buf;
+		int			type = entry->d_type;
+
+		if(strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) { continue; }
+		/* the path would not fit in the file list */
+		if(path_len + 1 + strlen(entry->d_name) >= PATHLEN) { continue; }
+		if(type != DT_DIR && type != DT_UNKNOWN && (type != DT_REG || !is_source_name(entry->d_name))) {
+			continue;
+		}
+		if(type == DT_UNKNOWN) {
+			if(fstatat(fd, entry->d_name, &buf, AT_SYMLINK_NOFOLLOW) != 0) { continue; }
+			type = S_ISDIR(buf.st_mode) ? DT_DIR : S_ISREG(buf.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+		snprintf(path, sizeof(path), "%s/%s", node->path, entry->d_name);
 
-		while((entry = readdir(dirfile)) != NULL) {
-			if((strcmp(".", entry->d_name) != 0) && (strcmp("..", entry->d_name) != 0)) {
-				struct stat buf;
+		if(type == DT_DIR) {
+			if(scanrecurse == true) {
+				scannode_t *dir = calloc(1, sizeof(*dir));
 
-				snprintf(path,
-					sizeof(path),
-					"%s/%.*s",
-					adir,
-					PATHLEN - 2 - adir_len,
-					entry->d_name);
-
-				if(lstat(path, &buf)) { continue; }
-
-				if(recurse_dir && S_ISDIR(buf.st_mode)) {
-					scan_dir(path, recurse_dir);
-				} else
-                if(is_source_file(path)
-                && !infilelist(path)
-                && access(path, R_OK) == 0) {
-					addsrcfile(path);
-				}
+				dir->path = strdup(path);
+				scan_item(node, NULL, dir);
+				scan_push(dir);
 			}
+		} else if(type == DT_REG && is_source_name(entry->d_name)
+		&& faccessat(fd, entry->d_name, R_OK, 0) == 0) {
+			scan_item(node, strdup(path), NULL);
 		}
-		closedir(dirfile);
 	}
-	return;
+	closedir(dirfile);
+}
+
+/* scan queued directories until there are none and none are being scanned */
+static
+void *scan_worker(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&scanlock);
+	for(;;) {
+		scannode_t *node;
+
+		while(nscanqueue == 0 && scanbusy > 0) {
+			pthread_cond_wait(&scancond, &scanlock);
+		}
+		if(nscanqueue == 0) { break; }
+		node = scanqueue[--nscanqueue];
+		++scanbusy;
+		pthread_mutex_unlock(&scanlock);
+		scan_node(node);
+		pthread_mutex_lock(&scanlock);
+		if(--scanbusy == 0 && nscanqueue == 0) { pthread_cond_broadcast(&scancond); }
+	}
+	pthread_mutex_unlock(&scanlock);
+	return NULL;
+}
+
+/* add the source files of a scanned directory tree to the list */
+static
+void scan_add(scannode_t *node) {
+	for(size_t i = 0; i < node->nitems; ++i) {
+		if(node->items[i].dir != NULL) {
+			scan_add(node->items[i].dir);
+		} else {
+			if(!infilelist(node->items[i].file)) { addsrcfile(node->items[i].file); }
+			free(node->items[i].file);
+		}
+	}
+	free(node->items);
+	free(node->path);
+	free(node);
+}
+
+/* scan a directory tree for source files on a pool of threads;
+ * each directory keeps its files and subdirectories in directory order,
+ * so that the files are added in the order of a depth first scan */
+static
+void scan_dir(const char *adir, bool recurse_dir) {
+	scannode_t *root;
+	pthread_t	threads[SCANTHREADS - 1];
+	int			nthreads = 0;
+
+	root		= calloc(1, sizeof(*root));
+	root->path	= strdup(adir);
+	scanrecurse = recurse_dir;
+	if(recurse_dir == true) {
+		scan_push(root);
+		while(nthreads < SCANTHREADS - 1
+		&& pthread_create(&threads[nthreads], NULL, scan_worker, NULL) == 0) {
+			++nthreads;
+		}
+		scan_worker(NULL); /* this thread works too */
+		while(nthreads > 0) {
+			pthread_join(threads[--nthreads], NULL);
+		}
+		free(scanqueue);
+		scanqueue  = NULL;
+		nscanqueue = mscanqueue = 0;
+	} else {
+		scan_node(root);
+	}
+	scan_add(root);
 }
 
 /* check if a file is readable enough to be allowed in the
@@ -366,17 +531,15 @@ bool is_accessible_file(const char *file) {
 	return false;
 }
 
-/* see if this is a source file */
+/* see if the file name is that of a source file */
 /* NOTE: these macros are somewhat faster than calling strcmp(),
  *        while not significantly uglier
  */
 #define IS_SUFFIX_OF_2(s, suffix) (s[0] == suffix[0] && s[1] == suffix[1])
 #define IS_SUFFIX_OF_3(s, suffix) (s[0] == suffix[0] && s[1] == suffix[1] && s[2] == suffix[2])
 static
-bool is_source_file(char *path) {
-	struct stat statstruct;
-	const char *file              = basename(path);
-	char	   *suffix            = strrchr(file, '.');
+bool is_source_name(const char *file) {
+	const char *suffix            = strrchr(file, '.');
 	bool		looks_like_source = false;
 
 	/* ensure there is some file suffix */
@@ -431,7 +594,14 @@ bool is_source_file(char *path) {
 		looks_like_source = true;
 	}
 
-	if (!looks_like_source) { return false; }
+	return looks_like_source;
+}
+
+/* see if this is a source file */
+bool is_source_file(char *path) {
+	struct stat statstruct;
+
+	if (!is_source_name(basename(path))) { return false; }
 
 	/* make sure it is a file */
 	if(lstat(path, &statstruct) == 0 && S_ISREG(statstruct.st_mode)) { return true; }
@@ -564,127 +734,491 @@ void makefilelist(const char * const * const argv) {
 	return;
 }
 
+/* hash an #include file name and its quote */
+static
+unsigned long hash_include(const char *file, char quote) {
+	return (hash_srcname(file) ^ (unsigned char)quote) * 1099511628211ULL;
+}
+
+/* find the cache slot of the #include, which is empty if it is not cached */
+static
+incresolve_t *find_include(const char *file, char quote, unsigned long h) {
+	unsigned long mask = minccache - 1;
+	unsigned long i;
+
+	for(i = h & mask; inccache[i].name != NULL; i = (i + 1) & mask) {
+		if(inccache[i].hash == h && inccache[i].quote == quote && strequal(file, inccache[i].name)) {
+			break;
+		}
+	}
+	return &inccache[i];
+}
+
+/* cache the resolution of an #include */
+static
+incresolve_t *cache_include(const char *file, char quote, int viewpath, int incdir) {
+	unsigned long h = hash_include(file, quote);
+	incresolve_t *r;
+
+	/* keep the cache at most half full */
+	if(2 * (ninccache + 1) > minccache) {
+		incresolve_t *old  = inccache;
+		unsigned long mold = minccache;
+
+		minccache = (minccache == 0) ? INCCACHEINIT : minccache * 2;
+		inccache  = calloc(minccache, sizeof(*inccache));
+		for(unsigned long i = 0; i < mold; ++i) {
+			if(old[i].name != NULL) {
+				*find_include(old[i].name, old[i].quote, old[i].hash) = old[i];
+			}
+		}
+		free(old);
+	}
+	if((r = find_include(file, quote, h))->name == NULL) {
+		r->name	 = strdup(file);
+		r->hash	 = h;
+		r->quote = quote;
+		++ninccache;
+	}
+	r->viewpath = viewpath;
+	r->incdir	= incdir;
+	return r;
+}
+
+/* find where an #include file is, looking it up in the cache first */
+static
+incresolve_t *resolve_include(const char *file, char quote) {
+	int	   viewpath = -1;
+	int	   incdir	= -1;
+	size_t file_len = strlen(file);
+
+	if(ninccache > 0) {
+		incresolve_t *r = find_include(file, quote, hash_include(file, quote));
+
+		if(r->name != NULL) { return r; }
+	}
+	/* look in current directory if it was #include "file" */
+	if(quote == '"') { viewpath = viewpath_index(file); }
+
+	/* search for the file in the #include directory list */
+	for(unsigned i = 0; viewpath == -1 && i < nincdirs; i++) {
+		char path[PATHLEN + 1];
+
+		/* make sure it exists and is readable */
+		snprintf(path,
+			sizeof(path),
+			"%.*s/%s",
+			(int)(PATHLEN - 2 - file_len),
+			incdirs[i],
+			file);
+		if(access(path, READ) == 0) {
+			incdir = i;
+			break;
+		}
+	}
+	return cache_include(file, quote, viewpath, incdir);
+}
+
 /* add an include file to the source file list */
 void incfile(char *file, char *type) {
+	char		  path[PATHLEN + 1];
+	incresolve_t *r;
+	int			  incdir;
+	size_t		  file_len;
+	stattime_t	  start;
+
 	assert(file != NULL); /* should never happen, but let's make sure anyway */
 
 	/* see if the file is already in the source file list */
 	if(infilelist(file) == true) { return; }
 
-	/* look in current directory if it was #include "file" */
-    {
-        char * s;
-        if(type[0] == '"' && (s = inviewpath(file)) != NULL) {
-            addsrcfile(s);
-            return;
-        }
-    }
+	stats_begin(&start);
+	r = resolve_include(file, type[0]);
+	stats_end(PHASE_INCLUDES, &start);
 
-	size_t file_len = strlen(file);
+	/* it was found in the view path if it was #include "file" */
+	if(r->viewpath != -1) {
+		viewpath_name(path, file, r->viewpath);
+		addsrcfile(path);
+		return;
+	}
+	if((incdir = r->incdir) == -1) { return; }
+
+	/* don't include the file from two directories */
+	file_len = strlen(file);
+	for(int i = 0; i <= incdir; i++) {
+		char name[PATHLEN + 1];
 
-	/* search for the file in the #include directory list */
-	for(unsigned i = 0; i < nincdirs; i++) {
-        char name[PATHLEN + 1];
-        char path[PATHLEN + 1];
-		/* don't include the file from two directories */
 		snprintf(name,
 			sizeof(name),
 			"%.*s/%s",
 			(int)(PATHLEN - 2 - file_len),
 			incnames[i],
 			file);
-		if(infilelist(name) == true) { break; }
-		/* make sure it exists and is readable */
-		snprintf(path,
-			sizeof(path),
-			"%.*s/%s",
-			(int)(PATHLEN - 2 - file_len),
-			incdirs[i],
-			file);
+		if(infilelist(name) == true) { return; }
+	}
+	snprintf(path,
+		sizeof(path),
+		"%.*s/%s",
+		(int)(PATHLEN - 2 - file_len),
+		incdirs[incdir],
+		file);
+	addsrcfile(path);
+}
 
-		if(access(path, READ) == 0) {
-			addsrcfile(path);
-			break;
+/* add a probed path to the list */
+static
+void add_probed(char ***paths, size_t *npaths, size_t *mpaths, const char *path) {
+	if(*npaths == *mpaths) {
+		*mpaths += DIRINC * 10;
+		*paths = realloc(*paths, *mpaths * sizeof(**paths));
+	}
+	(*paths)[(*npaths)++] = strdup(path);
+}
+
+/* get the directory of a probed path */
+static
+char *probed_dir(const char *path) {
+	char *dir = strdup(path);
+	char *s	  = strrchr(dir, '/');
+
+	if(s == NULL) {
+		free(dir);
+		dir = strdup(".");
+	} else if(s == dir) {
+		s[1] = '\0';
+	} else {
+		*s = '\0';
+	}
+	return dir;
+}
+
+static
+int compare_dirs(const void *s1, const void *s2) {
+	return strcmp(*(char *const *)s1, *(char *const *)s2);
+}
+
+/* sort a list of paths and free the duplicates, returning the new count */
+static
+size_t sort_unique(char **paths, size_t npaths) {
+	size_t n = 0;
+
+	if(npaths == 0) { return 0; }
+	qsort(paths, npaths, sizeof(*paths), compare_dirs);
+	for(size_t i = 1; i < npaths; ++i) {
+		if(strcmp(paths[i], paths[n]) != 0) {
+			paths[++n] = paths[i];
+		} else {
+			free(paths[i]);
 		}
 	}
+	return n + 1;
 }
 
-/* see if the file is already in the list */
-bool infilelist(const char * path) {
-	struct listitem *p;
+/* put the #include cache into the cross-reference file,
+ * with the modification times of the directories that were searched,
+ * so that it is only used while no files come or go in them;
+ * the directory of the database changes with every build,
+ * so for it the paths searched are put instead, with whether they exist */
+void put_inccache(void) {
+	char	  **paths  = NULL; /* paths searched */
+	size_t		npaths = 0;
+	size_t		mpaths = 0;
+	char	  **dirs;		   /* and their directories */
+	size_t		ndirs;
+	char	  **dbdirs;		   /* the names of the database directory */
+	size_t		ndbdirs = 0;
+	size_t		n		= 0;
+	struct stat dbdir;
+	struct stat st;
+	char		path[PATHLEN + 1];
+	char	   *dir;
+
+	if(includecache == false) { return; }
+	dir = probed_dir(reffile);
+	if(stat(dir, &dbdir) != 0) { dbdir.st_ino = 0; }
+	free(dir);
+
+	/* the paths that were searched */
+	for(unsigned long e = 0; e < minccache; ++e) {
+		const incresolve_t *r = &inccache[e];
+		size_t				file_len;
+
+		if(r->name == NULL) { continue; }
+		file_len = strlen(r->name);
+		if(r->quote == '"') {
+			add_probed(&paths, &npaths, &mpaths, r->name);
+			if(*r->name != '/' && vpndirs > 1) {
+				for(int i = 1; i < (int)nvpsrcdirs && (r->viewpath == -1 || i <= r->viewpath); ++i) {
+					viewpath_name(path, r->name, i);
+					add_probed(&paths, &npaths, &mpaths, path);
+				}
+			}
+			if(r->viewpath != -1) { continue; }
+		}
+		for(int i = 0; i < (int)nincdirs && (r->incdir == -1 || i <= r->incdir); ++i) {
+			snprintf(path,
+				sizeof(path),
+				"%.*s/%s",
+				(int)(PATHLEN - 2 - file_len),
+				incdirs[i],
+				r->name);
+			add_probed(&paths, &npaths, &mpaths, path);
+		}
+	}
+	npaths = sort_unique(paths, npaths);
 
-	char *dir_path = compress_path(path);
+	/* the directories that were searched, but the database directory */
+	dirs = malloc((npaths + 1) * sizeof(*dirs));
+	for(size_t i = 0; i < npaths; ++i) {
+		dirs[i] = probed_dir(paths[i]);
+	}
+	ndirs  = sort_unique(dirs, npaths);
+	dbdirs = malloc((ndirs + 1) * sizeof(*dbdirs));
+	for(size_t i = 0; i < ndirs; ++i) {
+		if(stat(dirs[i], &st) == 0 && st.st_ino == dbdir.st_ino && st.st_dev == dbdir.st_dev) {
+			dbdirs[ndbdirs++] = dirs[i];
+		} else {
+			dirs[n++] = dirs[i];
+		}
+	}
+	dbprintf("%lu\n", (unsigned long)n);
+	for(size_t i = 0; i < n; ++i) {
+		if(stat(dirs[i], &st) != 0) {
+			dbprintf("-1.0 %s\n", dirs[i]);
+		} else {
+			dbprintf("%lld.%09ld %s\n", (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, dirs[i]);
+		}
+		free(dirs[i]);
+	}
 
-	for(p = srcnames[hash(dir_path) % HASHMOD]; p != NULL; p = p->next) {
-		if(strequal(path, p->text)) {
-			free(dir_path);
-			return (true);
+	/* the paths that were searched in the database directory */
+	n = 0;
+	for(size_t i = 0; i < npaths; ++i) {
+		bool indbdir = false;
 
+		dir = probed_dir(paths[i]);
+		for(size_t d = 0; d < ndbdirs && indbdir == false; ++d) {
+			indbdir = strcmp(dir, dbdirs[d]) == 0;
+		}
+		free(dir);
+		if(indbdir == true) {
+			paths[n++] = paths[i];
+		} else {
+			free(paths[i]);
+		}
+	}
+	dbprintf("%lu\n", (unsigned long)n);
+	for(size_t i = 0; i < n; ++i) {
+		dbprintf("%d %s\n", stat(paths[i], &st) == 0, paths[i]);
+		free(paths[i]);
+	}
+	for(size_t d = 0; d < ndbdirs; ++d) {
+		free(dbdirs[d]);
+	}
+	free(dbdirs);
+	free(dirs);
+	free(paths);
+
+	/* the resolutions */
+	dbprintf("%lu\n", ninccache);
+	for(unsigned long e = 0; e < minccache; ++e) {
+		if(inccache[e].name != NULL) {
+			dbprintf("%c %d %d %s\n",
+				inccache[e].quote, inccache[e].viewpath, inccache[e].incdir, inccache[e].name);
 		}
 	}
+}
 
-	free(dir_path);
-	return (false);
+/* read the #include cache put into the old cross-reference file
+ * by a build with the same source and #include directories,
+ * unless files may have come or gone in the directories searched */
+void read_inccache(FILE *oldrefs) {
+	char		  name[PATHLEN + 1];
+	unsigned long n;
+	long long	  sec;
+	long		  nsec;
+
+	free_inccache();
+	if(includecache == false || fscanf(oldrefs, "%lu", &n) != 1) { return; }
+	while(n-- > 0) {
+		struct stat st;
+
+		if(fscanf(oldrefs, "%lld.%ld %" PATHLEN_STR "[^\n]", &sec, &nsec, name) != 3) { return; }
+		if(stat(name, &st) == 0 ? (st.st_mtim.tv_sec != sec || st.st_mtim.tv_nsec != nsec) : sec != -1) {
+			return;
+		}
+	}
+	/* and the files that were searched for in the database directory */
+	if(fscanf(oldrefs, "%lu", &n) != 1) { return; }
+	while(n-- > 0) {
+		struct stat st;
+		int			exists;
+
+		if(fscanf(oldrefs, "%d %" PATHLEN_STR "[^\n]", &exists, name) != 2
+		|| (stat(name, &st) == 0) != (exists != 0)) {
+			return;
+		}
+	}
+	if(fscanf(oldrefs, "%lu", &n) != 1) { return; }
+	while(n-- > 0) {
+		char quote;
+		int	 viewpath;
+		int	 incdir;
+
+		if(fscanf(oldrefs, " %c %d %d %" PATHLEN_STR "[^\n]", &quote, &viewpath, &incdir, name) != 4
+		|| viewpath < -1 || viewpath >= (int)nvpsrcdirs || incdir < -1 || incdir >= (int)nincdirs) {
+			free_inccache();
+			return;
+		}
+		cache_include(name, quote, viewpath, incdir);
+	}
 }
 
-/* search for the file in the view path */
-char *inviewpath(const char * file) {
-	static char	path[PATHLEN + 1];
+/* free the #include cache */
+void free_inccache(void) {
+	for(unsigned long i = 0; i < minccache; ++i) {
+		free(inccache[i].name);
+	}
+	free(inccache);
+	inccache  = NULL;
+	minccache = 0;
+	ninccache = 0;
+}
+
+/* hash a source file name (FNV-1a) */
+static
+unsigned long hash_srcname(const char *name) {
+	unsigned long long h = 14695981039346656037ULL;
+
+	while(*name != '\0') {
+		h = (h ^ (unsigned char)*name++) * 1099511628211ULL;
+	}
+	return (unsigned long)h;
+}
+
+/* find the registry slot of the name, which is empty if it is not registered */
+static
+srcname_t *find_srcname(const char *name, unsigned long h) {
+	unsigned long mask = msrcnames - 1;
+	unsigned long i;
+
+	for(i = h & mask; srcnames[i].name != NULL; i = (i + 1) & mask) {
+		if(srcnames[i].hash == h && strequal(name, srcnames[i].name)) { break; }
+	}
+	return &srcnames[i];
+}
+
+/* double the source file registry */
+static
+void grow_srcnames(void) {
+	srcname_t	 *old  = srcnames;
+	unsigned long mold = msrcnames;
+
+	msrcnames = (msrcnames == 0) ? SRCNAMEINIT : msrcnames * 2;
+	srcnames  = calloc(msrcnames, sizeof(*srcnames));
+	for(unsigned long i = 0; i < mold; ++i) {
+		if(old[i].name != NULL) { *find_srcname(old[i].name, old[i].hash) = old[i]; }
+	}
+	free(old);
+}
+
+/* see if the file is already in the list */
+bool infilelist(const char * path) {
+	char		  dir_path[PATHLEN + 1];
+	unsigned long h;
+
+	if(nsrcnames == 0) { return false; }
+	if(strlen(path) > PATHLEN) {
+		/* too long to compress on the stack */
+		char *s		= compress_path(path);
+		bool  found = infilelist(s);
+
+		free(s);
+		return found;
+	}
+	strcpy(dir_path, path);
+	compress_path_in_place(dir_path);
+	h = hash_srcname(dir_path);
+	return find_srcname(dir_path, h)->name != NULL;
+}
+
+/* search for the file in the view path, returning 0 if it is there as is,
+ * the index of the view path source directory it is in, or -1 */
+static
+int viewpath_index(const char *file) {
+	char path[PATHLEN + 1];
 
 	/* look for the file */
-	if(is_accessible_file(file)) {
-        strcpy(path, file);
-        return path;
-    }
+	if(is_accessible_file(file)) { return 0; }
 
 	/* if it isn't a full path name and there is a multi-directory
 	 * view path */
 	if(*file != '/'
     && vpndirs > 1) {
-		int file_len = strlen(file);
-
 		/* compute its path from higher view path source dirs */
 		for(unsigned i = 1; i < nvpsrcdirs; ++i) {
-			snprintf(path,
-				sizeof(path),
-				"%.*s/%s",
-				PATHLEN - 2 - file_len,
-				srcdirs[i],
-				file
-            );
-			if(is_accessible_file(path)) { return path; }
+			viewpath_name(path, file, i);
+			if(is_accessible_file(path)) { return i; }
 		}
 	}
 
-	return NULL;
+	return -1;
+}
+
+/* make the path of the file in the view path source directory */
+static
+void viewpath_name(char *path, const char *file, int i) {
+	if(i == 0) {
+		strcpy(path, file);
+		return;
+	}
+	snprintf(path,
+		PATHLEN + 1,
+		"%.*s/%s",
+		PATHLEN - 2 - (int)strlen(file),
+		srcdirs[i],
+		file
+	);
+}
+
+/* search for the file in the view path */
+char *inviewpath(const char * file) {
+	static char	path[PATHLEN + 1];
+	int			i = viewpath_index(file);
+
+	if(i == -1) { return NULL; }
+	viewpath_name(path, file, i);
+	return path;
 }
 
 /* add a source file to the list */
 void addsrcfile(char *path) {
-	struct listitem *p;
-	int				 i;
+	srcname_t	 *slot;
+	unsigned long h;
 
 	/* make sure there is room for the file */
 	if(nsrcfiles == msrcfiles) {
-		msrcfiles += SRCINC;
+		msrcfiles += (msrcfiles > SRCINC) ? msrcfiles : SRCINC;
 		srcfiles = realloc(srcfiles, msrcfiles * sizeof(*srcfiles));
 	}
-	/* add the file to the list */
+	/* keep the registry at most half full */
+	if(2 * (nsrcnames + 1) > msrcnames) { grow_srcnames(); }
+
+	/* add the file to the list and register its name */
 	char *dir_path = compress_path(path);
-	srcfiles[nsrcfiles++] = strdup(dir_path);
-	p					  = malloc(sizeof(*p));
-	p->text				  = strdup(dir_path);
-	free(dir_path);
-	i					  = hash(p->text) % HASHMOD;
-	p->next				  = srcnames[i];
-	srcnames[i]			  = p;
+	srcfiles[nsrcfiles++] = dir_path;
+	h					  = hash_srcname(dir_path);
+	slot				  = find_srcname(dir_path, h);
+	if(slot->name == NULL) {
+		slot->name = dir_path;
+		slot->hash = h;
+		++nsrcnames;
+	}
 }
 
 /* free the memory allocated for the source file list */
 void freefilelist(void) {
-	struct listitem *p, *nextp;
-	int				 i;
-
 	/* if '-d' option is used a string space block is allocated */
 	if(preserve_database == false) {
 		while(nsrcfiles > 0) {
@@ -701,15 +1235,11 @@ void freefilelist(void) {
 	msrcfiles = 0;
 	srcfiles  = 0;
 
-	for(i = 0; i < HASHMOD; ++i) {
-		for(p = srcnames[i]; p != NULL; p = nextp) {
-			/* HBB 20000421: avoid memory leak */
-			free(p->text);
-			nextp = p->next;
-			free(p);
-		}
-		srcnames[i] = NULL;
-	}
+	/* the registered names were those in srcfiles */
+	free(srcnames);
+	srcnames  = NULL;
+	msrcnames = 0;
+	nsrcnames = 0;
 }
 
 void freeinclist() {
@@ -69,7 +69,6 @@ static	int xstate;
 static	int count;
 static	int icount;
 static	char *input;
-static	long lnum;
 static	int iflag;
 static	jmp_buf	env;	/* setjmp/longjmp buffer */
 static	char *message;	/* error message */
@@ -552,12 +551,14 @@ char * egrepinit(const char *egreppat) {
     return(message);
 }
 
-static char buf[2 * BUFSIZ];
-static const char *buf_end = buf + (sizeof(buf) / sizeof(*buf));
-
+/* the tables made by egrepinit() are only read from here on, so
+ * egrep() can search files on several threads at once, each with
+ * its own buffer of 2 * BUFSIZ */
 static
-size_t read_next_chunk(char **p, FILE *fptr)
+size_t read_next_chunk(char *buf, char **p, FILE *fptr)
 {
+    const char *buf_end = buf + 2 * BUFSIZ;
+
     if (*p <= (buf + BUFSIZ)) {
         /* bwlow the middle, so enough space left for one entire BUFSIZ */
 	return fread(*p, sizeof(**p), BUFSIZ, fptr);
@@ -571,6 +572,9 @@ size_t read_next_chunk(char **p, FILE *fptr)
 }
 
 int egrep(const char * file, FILE *output, char *format) {
+    char buf[2 * BUFSIZ];
+    const char *buf_end = buf + (sizeof(buf) / sizeof(*buf));
+    long lnum;
     char *p;
     unsigned int cstat;
     int ccount;
@@ -585,7 +589,7 @@ int egrep(const char * file, FILE *output, char *format) {
     lnum = 1;
     p = buf;
     nlp = p;
-    ccount = read_next_chunk(&p, fptr);
+    ccount = read_next_chunk(buf, &p, fptr);
 
     if (ccount <= 0) {
 	fclose(fptr);
@@ -624,7 +628,7 @@ int egrep(const char * file, FILE *output, char *format) {
 		} /* if (p++ == \n) */
 	    cfound:
 		if (--ccount <= 0) {
-		    ccount = read_next_chunk(&p, fptr);
+		    ccount = read_next_chunk(buf, &p, fptr);
 		    if (ccount <= 0) {
 			if (in_line) {
 			    in_line = 0;
@@ -647,7 +651,7 @@ int egrep(const char * file, FILE *output, char *format) {
 	}
     brk2:
 	if (--ccount <= 0) {
-	    ccount = read_next_chunk(&p, fptr);
+	    ccount = read_next_chunk(buf, &p, fptr);
 	    if (ccount <= 0)
 		break;
 	}
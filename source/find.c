@@ -41,7 +41,11 @@
 #include "scanner.h" /* for token definitions */
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <ncurses.h>
 #include <regex.h>
 #include <setjmp.h> /* jmp_buf */
@@ -54,17 +58,43 @@
  * and restart the inner loop.
  */
 
+#define SEARCHTHREADS 64 /* most threads of a text search */
+
+/* A plain database is mapped for queries instead, and scanned in place
+ * as a single block that ends at the end of the file.
+ */
+
 char *blockp;							/* pointer to current char in block */
-char  block[BUFSIZ + 2];				/* leave room for end-of-block mark */
-int	  blocklen;							/* length of disk block read */
+char  blockbuf[BUFSIZ + 2];				/* leave room for end-of-block mark */
+char *block = blockbuf;					/* the block, or the mapped database */
+long  blocklen;							/* length of disk block read */
 char  blockmark;						/* mark character to be searched for */
 long  blocknumber;						/* block number */
 
+static char	  *dbmapped;				/* the mapped database */
+static size_t  dbmappedsize;			/* size of the mapping */
+static long	   dbmappedlen;				/* length of the database in it */
+static int	   dbmappedfd = -1;			/* the database file mapped */
+
 static char		global[] = "<global>";	/* dummy global function name */
 static char		cpattern[PATLEN + 1];	/* compressed pattern */
 static long		lastfcnoffset;			/* last function name offset */
 static POSTING *postingp;				/* retrieved posting set pointer */
 static long		postingsfound;			/* retrieved number of postings */
+
+typedef struct {   /* text search output of a source file */
+	char  *text;
+	size_t size;
+	bool   done;   /* searched */
+	bool   failed; /* could not be opened */
+} searchout_t;
+
+static searchout_t			*searchouts;  /* of each source file */
+static unsigned long		 nextsearch;  /* next file for a search thread */
+static volatile sig_atomic_t searchstop;  /* interrupted */
+static const char			*searchpath;  /* prepended to relative file names */
+static pthread_mutex_t		 searchlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		 searchcond = PTHREAD_COND_INITIALIZER;
 static regex_t	regexp;					/* regular expression */
 static bool		isregexp_valid = false; /* regular expression status */
 
@@ -74,6 +104,10 @@ static POSTING *getposting(void);
 static char	   *lcasify(const char *s);
 static void		findcalledbysub(const char *file, bool macro);
 static void		findterm(const char *pattern);
+static void		findfoldterm(const char *prefix);
+static bool		findgramterm(const char *pattern);
+static int		findliterals(const char *pattern, char *buf, char **literal);
+static const char *skipbracket(const char *s);
 static void		putline(FILE *output);
 static char	   *find_symbol_or_assignment(const char *pattern, bool assign_flag);
 static bool		check_for_assignment(void);
@@ -126,6 +160,8 @@ extern struct TI fields[FIELDS + 1];
 
 /* Internal prototypes: */
 static void jumpback(int sig);
+static void stopsearch(int sig);
+static void *search_worker(void *arg);
 
 static void jumpback(int sig) {
 	signal(sig, jumpback);
@@ -583,25 +619,111 @@ char *findstring(const char *pattern) {
 	return (findregexp(egreppat));
 }
 
-/* find this regular expression in the source files */
+/* stop a text search at an interrupt, once the files being searched are done */
+static
+void stopsearch(int sig) {
+	signal(sig, stopsearch);
+	searchstop = 1;
+}
+
+/* search the source files not taken by another thread, each into its own buffer */
+static
+void *search_worker(void *arg) {
+	char		  path[PATHLEN + 1];
+	unsigned long i;
+
+	UNUSED(arg);
+	for(;;) {
+		const char *file;
+		FILE	   *output;
+		bool		failed;
+
+		pthread_mutex_lock(&searchlock);
+		i = nextsearch++;
+		pthread_mutex_unlock(&searchlock);
+		if(i >= nsrcfiles || searchstop != 0) { break; }
+
+		/* prepend_path() has a single buffer */
+		file = srcfiles[i];
+		if(searchpath != NULL && *file != '/') {
+			snprintf(path, sizeof(path), "%s/%s", searchpath, file);
+			file = path;
+		}
+		output = open_memstream(&searchouts[i].text, &searchouts[i].size);
+		failed = output == NULL || egrep(file, output, "%s <unknown> %ld ") < 0;
+		if(output != NULL) { fclose(output); }
+
+		pthread_mutex_lock(&searchlock);
+		searchouts[i].failed = failed;
+		searchouts[i].done	 = true;
+		pthread_cond_broadcast(&searchcond);
+		pthread_mutex_unlock(&searchlock);
+	}
+	pthread_mutex_lock(&searchlock);
+	pthread_cond_broadcast(&searchcond);
+	pthread_mutex_unlock(&searchlock);
+	return NULL;
+}
+
+/* find this regular expression in the source files;
+ * the files are searched on a pool of threads sharing the compiled pattern,
+ * and their output is added to the references in source file order */
 static
 char *findregexp(const char *egreppat) {
-	unsigned int i;
+	pthread_t	 threads[SEARCHTHREADS];
+	int			 nthreads = 0, wanted;
+	sighandler_t savesig;
 	char		*egreperror;
 
 	/* compile the pattern */
-	if((egreperror = egrepinit(egreppat)) == NULL) {
+	if((egreperror = egrepinit(egreppat)) != NULL || nsrcfiles == 0) { return (egreperror); }
+	if((searchouts = calloc(nsrcfiles, sizeof(*searchouts))) == NULL) {
+		postfatal(PROGRAM_NAME ": out of memory for the text search\n");
+		/* NOTREACHED */
+	}
+	nextsearch = 0;
+	searchstop = 0;
+	searchpath = prependpath;
+	savesig	   = signal(SIGINT, stopsearch);
+
+	/* search the files */
+	wanted = sysconf(_SC_NPROCESSORS_ONLN);
+	if(wanted > SEARCHTHREADS) { wanted = SEARCHTHREADS; }
+	if((unsigned long)wanted > nsrcfiles) { wanted = nsrcfiles; }
+	while(nthreads < wanted && pthread_create(&threads[nthreads], NULL, search_worker, NULL) == 0) {
+		++nthreads;
+	}
+	if(nthreads == 0) { search_worker(NULL); }
 
-		/* search the files */
-		for(i = 0; i < nsrcfiles; ++i) {
-			const char * file = prepend_path(prependpath, srcfiles[i]);
+	/* and add their output in order */
+	for(unsigned long i = 0; i < nsrcfiles; ++i) {
+		bool done;
 
-			progress("Search", searchcount, nsrcfiles);
-			if(egrep(file, refsfound, "%s <unknown> %ld ") < 0) {
-				posterr("Cannot open file %s", file);
-			}
+		pthread_mutex_lock(&searchlock);
+		while(searchouts[i].done == false && searchstop == 0) {
+			pthread_cond_wait(&searchcond, &searchlock);
+		}
+		done = searchouts[i].done;
+		pthread_mutex_unlock(&searchlock);
+		if(done == false) { break; }
+
+		progress("Search", searchcount, nsrcfiles);
+		if(searchouts[i].failed == true) {
+			posterr("Cannot open file %s", prepend_path(prependpath, srcfiles[i]));
 		}
+		UNUSED(fwrite(searchouts[i].text, 1, searchouts[i].size, refsfound));
+		free(searchouts[i].text);
+		searchouts[i].text = NULL;
 	}
+	while(nthreads > 0) {
+		pthread_join(threads[--nthreads], NULL);
+	}
+	for(unsigned long i = 0; i < nsrcfiles; ++i) {
+		free(searchouts[i].text);
+	}
+	free(searchouts);
+	searchouts = NULL;
+	signal(SIGINT, savesig);
 	return (egreperror);
 }
 
@@ -967,8 +1089,19 @@ char *scanpast(char c) {
 
 /* read a block of the cross-reference */
 char *read_crossreference_block(void) {
+	block = blockbuf;
+	if(symrefs == dbmappedfd) {
+		/* the mapped database is a single block, so this is past its end */
+		blocklen	 = 0;
+		block[0]	 = blockmark;
+		block[1]	 = '\0';
+		blocknumber = -1;
+		blockp		 = NULL;
+		return NULL;
+	}
 	/* read the next block */
-	blocklen = read(symrefs, block, BUFSIZ);
+	blocklen = dbzread(symrefs, block, BUFSIZ);
+	if(blocklen < 0) { blocklen = 0; } /* an unreadable block ends the scan */
 	blockp	 = block;
 
 	/* add the search character and end-of-block mark */
@@ -1058,15 +1191,31 @@ void findterm(const char *pattern) {
 	char *s;
 	int	  len;
 	char  prefix[PATLEN + 1];
-	char  term[PATLEN + 1];
+	char  term[TERMMAX];
 
 	npostings	  = 0; /* will be non-zero after database built */
 	lastfcnoffset = 0; /* clear the last function name found */
 	boolclear();	   /* clear the posting set */
 
-	/* get the string prefix (if any) of the regular expression */
+	/* get the string prefix (if any) of the regular expression,
+	   without the character before a ?, * or { as it need not be there;
+	   with alternatives there is none */
 	strcpy(prefix, pattern);
-	if((s = strpbrk(prefix, ".[{*+")) != NULL) { *s = '\0'; }
+	if(strchr(prefix, '|') != NULL) {
+		*prefix = '\0';
+	} else if((s = strpbrk(prefix, ".[{*+?()\\^$")) != NULL) {
+		if(s > prefix && strchr("?*{", *s) != NULL) { --s; }
+		*s = '\0';
+	}
+	/* without a prefix that narrows the terms to match, only the terms
+	   with the trigrams of the literal strings of the pattern are matched */
+	if(strlen(prefix) < 3 && findgramterm(pattern) == true) { return; }
+	/* if letter case is to be ignored and the index has its terms
+	   in lower case order, only the terms with the prefix are matched */
+	if(caseless == true && invfoldfind(&invcontrol, strcpy(prefix, lcasify(prefix))) != -1) {
+		findfoldterm(prefix);
+		return;
+	}
 	/* if letter case is to be ignored */
 	if(caseless == true) {
 
@@ -1121,6 +1270,156 @@ void findterm(const char *pattern) {
 	postingsfound = npostings;
 }
 
+/* find the terms of a caseless search in the case-folded term table,
+ * which invfoldfind() has positioned at the first with the lower case prefix */
+static
+void findfoldterm(const char *prefix) {
+	char   term[TERMMAX];
+	size_t len = strlen(prefix);
+
+	do {
+		if(invfoldterm(&invcontrol, term) > 0) {
+			/* stop past the terms with the prefix */
+			if(strncmp(term, prefix, len) != 0) { break; }
+			/* add the postings of a matching term to the set */
+			if(regexec(&regexp, term, (size_t)0, NULL, 0) == 0
+			&& (postingp = boolfile(&invcontrol, &npostings, bool_OR)) == NULL) {
+				break;
+			}
+		}
+		/* display progress about every three seconds */
+		if(++searchcount % 50 == 0) {
+			progress("Symbols matched", searchcount, totalterms);
+		}
+	} while(invfoldforward(&invcontrol));
+	/* initialize the progress message for retrieving the references */
+	searchcount	  = 0;
+	postingsfound = npostings;
+}
+
+/* find the terms of a search without a prefix through the trigram table;
+ * false if the index has none or the pattern has no trigram to look up */
+static
+bool findgramterm(const char *pattern) {
+	char  buf[2 * PATLEN + 2];
+	char *literal[PATLEN + 1];
+	char  term[TERMMAX];
+	char *s;
+	long  found;
+
+	if((found = invgramfind(&invcontrol, literal, findliterals(pattern, buf, literal))) < 0) {
+		return false;
+	}
+	while(found > 0) {
+		if(invgramterm(&invcontrol, term) > 0) {
+			s = term;
+			if(caseless == true) { s = lcasify(s); }
+			/* add the postings of a matching term to the set */
+			if(regexec(&regexp, s, (size_t)0, NULL, 0) == 0
+			&& (postingp = boolfile(&invcontrol, &npostings, bool_OR)) == NULL) {
+				break;
+			}
+		}
+		/* display progress about every three seconds */
+		if(++searchcount % 50 == 0) {
+			progress("Symbols matched", searchcount, found);
+		}
+		if(invgramforward(&invcontrol) == 0) { break; }
+	}
+	/* initialize the progress message for retrieving the references */
+	searchcount	  = 0;
+	postingsfound = npostings;
+	return true;
+}
+
+/* split a symbol search pattern into the literal strings that every term
+ * it matches contains, in buf; returns their number, which is 0 for
+ * a pattern with alternatives, as none of them need be in a match */
+static
+int findliterals(const char *pattern, char *buf, char **literal) {
+	char *run = buf, *b = buf;
+	int	  n = 0;
+
+	if(strlen(pattern) > PATLEN || strchr(pattern, '|') != NULL) { return 0; }
+	for(const char *s = pattern; *s != '\0'; ++s) {
+		switch(*s) {
+			case '\\':
+				/* an escaped special character is itself */
+				if(s[1] != '\0' && strchr(".[]{}()*+?^$\\", s[1]) != NULL) {
+					*b++ = *++s;
+					continue;
+				}
+				if(s[1] != '\0') { ++s; }
+				break;
+			case '*':
+			case '?':
+			case '{':
+				/* the character before need not be there */
+				if(b > run) { --b; }
+				if(*s == '{' && (s = strchr(s, '}')) == NULL) { return n; }
+				break;
+			case '[':
+				if(*(s = skipbracket(s)) == '\0') { return n; }
+				break;
+			case '(':
+				/* the group may be optional, so skip it */
+				for(int depth = 0; *s != '\0'; ++s) {
+					if(*s == '\\' && s[1] != '\0') {
+						++s;
+					} else if(*s == '[') {
+						if(*(s = skipbracket(s)) == '\0') { return n; }
+					} else if(*s == '(') {
+						++depth;
+					} else if(*s == ')' && --depth == 0) {
+						break;
+					}
+				}
+				if(*s == '\0') { return n; }
+				break;
+			case '.':
+			case '+':
+			case ')':
+			case '^':
+			case '$':
+				break;
+			default:
+				*b++ = *s;
+				continue;
+		}
+		/* end the literal string */
+		if(b > run) {
+			*b++		 = '\0';
+			literal[n++] = run;
+			run			 = b;
+		}
+	}
+	if(b > run) {
+		*b++		 = '\0';
+		literal[n++] = run;
+	}
+	return n;
+}
+
+/* the ] that ends the bracket expression at s, or the null after it */
+static
+const char *skipbracket(const char *s) {
+	if(*++s == '^') { ++s; }
+	if(*s == ']') { ++s; }
+	for(; *s != '\0' && *s != ']'; ++s) {
+		/* [:class:], [.coll.] and [=equiv=] */
+		if(*s == '[' && (s[1] == ':' || s[1] == '.' || s[1] == '=')) {
+			const char *end = strchr(s + 2, s[1]);
+
+			while(end != NULL && end[1] != ']') {
+				end = strchr(end + 1, s[1]);
+			}
+			if(end == NULL) { return s + strlen(s); }
+			s = end + 1;
+		}
+	}
+	return s;
+}
+
 /* get the next posting for this term */
 static
 POSTING *getposting(void) {
@@ -1169,8 +1468,25 @@ long dbseek(long offset) {
 	long n;
 	int	 rc = 0;
 
+	if(symrefs == dbmappedfd) {
+		if(offset < 0 || offset > dbmappedlen) {
+			errno = EINVAL;
+			myperror("Lseek failed");
+			return -1;
+		}
+		if(blocknumber != 0) {
+			block		= dbmapped;
+			blocklen	= dbmappedlen;
+			blocknumber = 0;
+			/* add the search character and end-of-block mark */
+			block[blocklen]		= blockmark;
+			block[blocklen + 1] = '\0';
+		}
+		blockp = block + offset;
+		return rc;
+	}
 	if((n = offset / BUFSIZ) != blocknumber) {
-		if((rc = lseek(symrefs, n * BUFSIZ, 0)) == -1) {
+		if((rc = dbzlseek(symrefs, n * BUFSIZ)) == -1) {
 			myperror("Lseek failed");
 			sleep(3);
 			return rc;
@@ -1182,6 +1498,53 @@ long dbseek(long offset) {
 	return rc;
 }
 
+/* map the opened database, if it is plain, for the queries;
+ * the mapping is private so that the marks can be put after its end,
+ * where the rest of its last page or a page of its own has room for them */
+void dbmap(void) {
+	struct stat st;
+	long		pagesize = sysconf(_SC_PAGESIZE);
+	size_t		size;
+	char	   *p;
+
+	dbunmap();
+	if(symrefs < 0 || dbzmappable(symrefs) == false || fstat(symrefs, &st) == -1
+	|| st.st_size == 0 || pagesize <= 0) {
+		return;
+	}
+	size = ((size_t)st.st_size + 2 + pagesize - 1) / pagesize * pagesize;
+	if((p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		return;
+	}
+	if(mmap(p, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, symrefs, 0) == MAP_FAILED) {
+		munmap(p, size);
+		return;
+	}
+	dbmapped	 = p;
+	dbmappedsize = size;
+	dbmappedlen	 = st.st_size;
+	dbmappedfd	 = symrefs;
+	blocknumber	 = -1;
+}
+
+/* drop the mapping before the database is closed */
+void dbunmap(void) {
+	if(dbmapped == NULL) { return; }
+	if(block == dbmapped) {
+		block	 = blockbuf;
+		blocklen = 0;
+	}
+	munmap(dbmapped, dbmappedsize);
+	dbmapped	= NULL;
+	dbmappedfd	= -1;
+	blocknumber = -1;
+}
+
+/* tell the kernel how the mapped database is about to be read */
+void dbadvise(int advice) {
+	if(dbmapped != NULL) { madvise(dbmapped, dbmappedsize, advice); }
+}
+
 static
 void findcalledbysub(const char *file, bool macro) {
 	/* find the next function call or the end of this function */
@@ -1272,6 +1635,9 @@ bool search(const char *query) {
 				return (false);
 			}
 			if((rc = findinit(query)) == NOERROR) {
+				/* the inverted index jumps to its postings,
+				   other searches read the database through */
+				dbadvise(invertedindex == true ? MADV_RANDOM : MADV_SEQUENTIAL);
 				UNUSED(dbseek(0L)); /* read the first block */
 				findresult = (*f)(query);
 				if(f == findcalledby){
@@ -1295,7 +1661,7 @@ bool search(const char *query) {
 	signal(SIGINT, savesig);
 
 	/* rewind the cross-reference file */
-	lseek(symrefs, (long)0, 0);
+	dbzlseek(symrefs, 0);
 
 	/* reopen the references found file for reading */
 	fclose(refsfound);
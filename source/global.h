@@ -148,11 +148,12 @@ extern unsigned int curdispline;
 extern char			newpat[]; /* new pattern */
 
 /* crossref.c global data */
-extern long			 dboffset;	  /* new database offset */
 extern bool			 errorsfound; /* prompt before clearing error messages */
 extern long			 lineoffset;  /* source line database offset */
 extern long			 npostings;	  /* number of postings */
 extern unsigned long symbols;	  /* number of symbols */
+extern unsigned long long lexedhash; /* content hash of the file last cross-referenced */
+extern long			 lexedsize;	  /* and its size, or -1 if it was not mapped */
 
 /* dir.c global data */
 extern char	  currentdir[]; /* current directory */
@@ -163,6 +164,7 @@ extern size_t nincdirs;		/* number of #include directories */
 extern size_t nsrcdirs;		/* number of source directories */
 extern size_t nsrcfiles;	/* number of source files */
 extern size_t msrcfiles;	/* maximum number of source files */
+extern bool	  includecache; /* keep the #include cache in the database */
 
 /* display.c global data */
 extern int			filelen;	  /* file name display field length */
@@ -176,11 +178,12 @@ extern long			searchcount;  /* count of files searched */
 extern unsigned int totallines;	  /* total reference lines */
 
 /* find.c global data */
-extern char	 block[];	  /* cross-reference file block */
+extern char	*block;		  /* cross-reference file block, or the mapped file */
+extern char	 blockbuf[];  /* block read from the file */
 extern char	 blockmark;	  /* mark character to be searched for */
 extern long	 blocknumber; /* block number */
 extern char *blockp;	  /* pointer to current character in block */
-extern int	 blocklen;	  /* length of disk block read */
+extern long	 blocklen;	  /* length of disk block read */
 
 /* lookup.c global data */
 extern struct keystruct {
@@ -275,6 +278,10 @@ void redisplay(void);
 void shellpath(char *out, int limit, char *in);
 
 bool infilelist(const char * file);
+void put_inccache(void);
+void read_inccache(FILE *oldrefs);
+void free_inccache(void);
+bool is_source_file(char *path);
 bool readrefs(char *filename);
 bool search(const char *query);
 bool writerefsfound(void);
@@ -285,6 +292,9 @@ int	 egrep(const char * file, FILE *output, char *format);
 int	 hash(const char * ss);
 int	 execute(char *a, ...);
 long dbseek(long offset);
+void dbmap(void);
+void dbunmap(void);
+void dbadvise(int advice);
 
 void mousecleanup(void);
 int process_mouse(void);
@@ -112,7 +112,9 @@ const char * help(void) {
 void usage(void) {
 	fputs("Usage: " PROGRAM_NAME
 		  " [-bcCdehklLqRTuUvV] [-f file] [-F file] [-i file] [-I dir] [-s dir]\n"
-		  "              [-p number] [-P path] [-[0-8] pattern] [source files]\n",
+		  "              [-j jobs] [-p number] [-P path] [-[0-8] pattern] [--sort-memory mb]\n"
+		  "              [--watch] [--include-cache]\n"
+		  "              [--build-stats] [--block-compress] [source files]\n",
 		stderr);
 }
 
@@ -134,7 +136,9 @@ void longusage(void) {
 		"\
 -h            This help screen.\n\
 -I incdir     Look in incdir for any #include files.\n\
--i namefile   Browse through files listed in namefile, instead of %s\n",
+-i namefile   Browse through files listed in namefile, instead of %s\n\
+-j jobs       Cross-reference source files in jobs parallel processes\n\
+              and sort the inverted index postings in jobs threads.\n",
 		NAMEFILE);
 	fprintf(stderr,
 		"\
@@ -154,6 +158,20 @@ void longusage(void) {
 -u            Unconditionally build the cross-reference file.\n\
 -v            Be more verbose in line mode.\n\
 -V            Print the version number.\n\
+--sort-memory mb\n\
+              Sort inverted index postings in mb megabytes of memory\n\
+              before spilling them to temporary files.\n\
+--watch       Build the cross-reference, then keep it up to date\n\
+              as the source files change.\n\
+--include-cache\n\
+              Keep where #include files were found in the database,\n\
+              so rebuilds need not search the #include directories again.\n\
+--build-stats Report the time and throughput of each build phase,\n\
+              the bytes lexed, copied and written and the slowest files\n\
+              on stderr as a line of JSON.\n\
+--block-compress\n\
+              Write the cross-reference in separately compressed blocks,\n\
+              which any offset can still be read from directly.\n\
 \n\
 Please see the manpage for more information.\n",
 		stderr);
@@ -32,8 +32,11 @@
 
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #if SHARE
 # include <sys/types.h>
 # include <sys/ipc.h>
@@ -46,16 +49,93 @@
 
 #include <assert.h>
 
-#define DEBUG	   0		  /* debugging code and realloc messages */
-#define BLOCKSIZE  2 * BUFSIZ /* logical block size */
-#define POSTINC	   10000	  /* posting buffer size increment */
-#define SEP		   ' '		  /* sorted posting field separator */
-#define SETINC	   100		  /* posting set size increment */
-#define STATS	   0		  /* print statistics */
-#define SUPERINC   10000	  /* super index size increment */
-#define TERMMAX	   512		  /* term max size */
-#define FMTVERSION 1		  /* inverted index format version */
-#define ZIPFSIZE   200		  /* zipf curve size */
+#define DEBUG		0			 /* debugging code and realloc messages */
+#define BLOCKSIZE	(8 * BUFSIZ) /* logical block size */
+#define POSTINC		10000		 /* posting buffer size increment */
+#define SETINC		100			 /* posting set size increment */
+#define STATS		0			 /* print statistics */
+#define SUPERINC	10000		 /* super index size increment */
+#define FMTVERSION	3			 /* inverted index format version */
+#define FMTVERSION2 2			 /* the uncompressed postings format still read */
+#define FMTVERSION1 1			 /* the native long format still read */
+#define VARINTMAX	10			 /* bytes of the longest varint */
+#define ZIPFSIZE	200			 /* zipf curve size */
+#define WORDSIZE	sizeof(int64_t) /* size of the block and superfinger words */
+#define GRAMCHARS	38			 /* trigram alphabet: letters, digits and _, from 1 */
+#define GRAMS		(GRAMCHARS * GRAMCHARS * GRAMCHARS) /* trigram codes */
+#define GRAMFIND	16			 /* most trigrams intersected for a search */
+
+/* Version 2 and later indexes are written in fixed width words, so their sizes
+ *  and offsets do not depend on the long of the machine that wrote them.
+ * Version 3 compresses the posting list of each term, which version 2
+ *  stored as an array of POSTINGs. The list is
+ *	varint postings size,
+ *	varint skip table size, 0 as none is written yet; a reader that
+ *		does not use the table passes over it,
+ *	the skip table,
+ *	the postings, each as varints of
+ *		the line offset delta from the posting before (from 0 for the first),
+ *		the file index delta, shifted left 8 bits, with the type,
+ *		the zigzag coded line offset - function offset, plus 1,
+ *		or 0 if there is no function.
+ * A case-folded term table may follow the superfinger, for caseless searches:
+ *	the number of terms,
+ *	a FOLDENTRY per term, in the order of the lower case terms,
+ *	the lower case terms.
+ * A trigram table may follow that, for searches without a usable prefix:
+ *	the number of trigrams,
+ *	a GRAMENTRY per trigram of the lower case terms, in trigram code order,
+ *	the list of each, as varint deltas of the case-folded term table
+ *		entries with the trigram (from -1 for the first).
+ * Only letters, digits and _ make trigrams.
+ * Older indexes have 0 for the sizes of these tables, in the control area
+ *  words that were left for future use.
+ * Version 1 indexes were written in native longs, with 16 bit term offsets
+ *  in 2 * BUFSIZ blocks, 8 bit term sizes and 24 bit file indexes;
+ *  their layout is kept here so that they can still be read */
+typedef struct {
+	long version;
+	long filestat;
+	long sizeblk;
+	long startbyte;
+	long supsize;
+	long cntlsize;
+	long share;
+} PARAM1;
+
+typedef struct {
+	short		  offset;
+	unsigned char size;
+	unsigned char space;
+	long		  post;
+} ENTRY1;
+
+typedef struct {
+	long lineoffset;
+	long fcnoffset;
+	long fileindex : 24;
+	long type	   : 8;
+} POSTING1;
+
+typedef struct {	 /* case-folded term table entry */
+		uint32_t block; /* logical block of the term */
+		uint32_t item;	/* and its entry in it */
+		int64_t	 text;	/* lower case term, from the start of the table */
+} FOLDENTRY;
+
+typedef struct {	  /* trigram table entry */
+		uint32_t gram;	  /* trigram code */
+		uint32_t count;	  /* number of terms with the trigram */
+		int64_t	 list;	  /* their list, from the start of the table */
+} GRAMENTRY;
+
+typedef struct {						  /* reader of a term's postings */
+		INVCONTROL			*invcntl;
+		const unsigned char *data;		  /* next compressed posting, or NULL */
+		const unsigned char *end;
+		long				 left;		  /* postings not yet read */
+		POSTING				 last;		  /* the posting read last */
+} POSTCURSOR;
 
 #if DEBUG
 /* FIXME HBB 20010705: nowhere in the source is `invbreak' ever set to
@@ -67,6 +147,28 @@ int invbreak;
 static int	boolready(void);
 static int	invnewterm(void);
 static void invstep(INVCONTROL *invcntl);
+static void invmapfiles(INVCONTROL *invcntl);
+static bool foldblock(void);
+static bool putfold(void);
+static long foldcount(INVCONTROL *invcntl);
+static void foldfree(void);
+static long gramcode(const char *s);
+static bool putgrams(void);
+static long gramcount(INVCONTROL *invcntl);
+static void invblock(INVCONTROL *invcntl, long n);
+static int64_t blockword(INVCONTROL *invcntl, long i);
+static int64_t superword(INVCONTROL *invcntl, long i);
+static ENTRY   getentry(INVCONTROL *invcntl, long n);
+static int64_t postingsoffset(INVCONTROL *invcntl, ENTRY *entry);
+static size_t  readpostings(INVCONTROL *invcntl, POSTING *postings, size_t n);
+static bool	   postfirst(INVCONTROL *invcntl, ENTRY *entry, POSTCURSOR *cur);
+static bool	   postnext(POSTCURSOR *cur, POSTING *posting);
+static unsigned char		 *putvarint(unsigned char *p, uint64_t v);
+static const unsigned char *getvarint(const unsigned char *p, const unsigned char *end, uint64_t *v);
+static bool	   putpostings(POSTING *postings, long n);
+static bool	   entrypostings(INVCONTROL *invcntl, ENTRY *entry, POSTING *postings);
+static POSTING *growset(POSTING **set, size_t *size, size_t n);
+static size_t  putparam(INVCONTROL *invcntl);
 static void invcannotalloc(unsigned n);
 static void invcannotopen(char *file);
 static void invcannotwrite(char *file);
@@ -76,21 +178,31 @@ int showzipf; /* show postings per term distribution */
 #endif
 
 static POSTING		 *item, *enditem, *item1 = NULL, *item2 = NULL;
-static unsigned int	  setsize1, setsize2;
-static long			  numitems, totterm, zerolong;
+static size_t		  setsize1, setsize2;
+static POSTING		 *termset; /* postings of the term being merged */
+static size_t		  termsetsize;
+static long			  numitems, totterm;
+static int64_t		  zeroword;
 static char			 *indexfile, *postingfile;
 static FILE			 *outfile, *fpost;
 static size_t		  supersize = SUPERINC, supintsize;
-static unsigned int	  numpost, numlogblk, amtused, nextpost;
+static unsigned int	  numpost, numlogblk, amtused;
+static int64_t		  nextpost;
 static unsigned int	  lastinblk, numinvitems;
 static POSTING		 *POST, *postptr;
-static unsigned long *SUPINT, *supint, nextsupfing;
+static int64_t		 *SUPINT, *supint, nextsupfing;
 static char			 *SUPFING, *supfing;
 static char			  thisterm[TERMMAX];
+static unsigned char *postbuf;	/* compressed posting list */
+static size_t		  postbufsize;
+static FOLDENTRY	 *FOLD;		/* case-folded term table being made */
+static size_t		  nfold, foldsize;
+static char			 *FOLDTEXT; /* and its lower case terms */
+static size_t		  foldtextlen, foldtextsize;
 
 typedef union logicalblk {
-	long invblk[BLOCKSIZE / sizeof(long)];
-	char chrblk[BLOCKSIZE];
+	int64_t invblk[BLOCKSIZE / WORDSIZE];
+	char	chrblk[BLOCKSIZE];
 } t_logicalblk;
 
 static t_logicalblk logicalblk;
@@ -103,15 +215,13 @@ static long totpost;
 static int zipf[ZIPFSIZE + 1];
 #endif
 
-long invmake(char *invname, char *invpost, FILE *infile) {
-	unsigned char *s;
-	long		   num;
-	int			   i;
-	long		   fileindex = 0; /* initialze, to avoid warning */
-	unsigned	   postsize	 = POSTINC * sizeof(*POST);
-	unsigned long *intptr;
-	char		   line[TERMMAX];
-	long		   tlong;
+long invmake(char *invname, char *invpost, const TERMPOSTING *(*getposting)(void)) {
+	const TERMPOSTING *termposting;
+	int				   i;
+	long			   fileindex = 0; /* initialze, to avoid warning */
+	unsigned		   postsize	 = POSTINC * sizeof(*POST);
+	int64_t			  *intptr;
+	int64_t			   tlong;
 	PARAM		   param;
 	POSTING		   posting;
 	char		   temp[BLOCKSIZE];
@@ -166,33 +276,28 @@ long invmake(char *invname, char *invpost, FILE *infile) {
 #endif
 	totterm = 0L;
 	numpost = 1;
+	nfold = foldtextlen = 0;
 
 	/* set up as though a block had come and gone, i.e., set up for new block  */
-	/* 3 longs needed for: numinvitems, next block, and previous block */
-	amtused		= 3 * sizeof(long);
+	/* 3 words needed for: numinvitems, next block, and previous block */
+	amtused		= 3 * WORDSIZE;
 	numinvitems = 0;
 	numlogblk	= 0;
 	lastinblk	= sizeof(t_logicalblk);
 
 	/* now loop as long as more to read (till eof)  */
-	while(fgets(line, TERMMAX, infile) != NULL) {
+	while((termposting = getposting()) != NULL) {
 #if DEBUG || STATS
 		++totpost;
 #endif
-		s = strchr(line, SEP);
-		if(s != NULL) {
-			*s = '\0';
-		} else {
-			continue;
-		}
 #if STATS
-		if((i = strlen(line)) > maxtermlen) { maxtermlen = i; }
+		if((i = strlen(termposting->term)) > maxtermlen) { maxtermlen = i; }
 #endif
 #if DEBUG
-		printf("%ld: %s ", totpost, line);
+		printf("%ld: %s ", totpost, termposting->term);
 		fflush(stdout);
 #endif
-		if(strcmp(thisterm, line) == 0) {
+		if(strcmp(thisterm, termposting->term) == 0) {
 			if((postptr + 10) > (POST + (postsize / sizeof(*POST)))) {
 				i = postptr - POST;
 				postsize += POSTINC * sizeof(*POST);
@@ -209,36 +314,22 @@ long invmake(char *invname, char *invpost, FILE *infile) {
 		} else {
 			/* have a new term */
 			if(!invnewterm()) { return (0); }
-			strcpy(thisterm, line);
+			snprintf(thisterm, sizeof(thisterm), "%s", termposting->term);
 			numpost	  = 1;
 			postptr	  = POST;
 			fileindex = 0;
 		}
 		/* get the new posting */
-		num = *++s - '!';
-		i	= 1;
-		do {
-			num = BASE * num + *++s - '!';
-		} while(++i < PRECISION);
-		posting.lineoffset = num;
-		while(++fileindex < nsrcfiles && num > srcoffset[fileindex]) {
+		posting.lineoffset = termposting->lineoffset;
+		while(++fileindex < nsrcfiles && posting.lineoffset > srcoffset[fileindex]) {
 			;
 		}
 		posting.fileindex = --fileindex;
-		posting.type	  = *++s;
-		++s;
-		if(*s != '\n') {
-			num = *++s - '!';
-			while(*++s != '\n') {
-				num = BASE * num + *s - '!';
-			}
-			posting.fcnoffset = num;
-		} else {
-			posting.fcnoffset = 0;
-		}
+		posting.type	  = termposting->type;
+		posting.fcnoffset = termposting->fcnoffset;
 		*postptr++ = posting;
 #if DEBUG
-		printf("%ld %ld %ld %ld\n",
+		printf("%d %" PRId64 " %" PRId64 " %d\n",
 			posting.fileindex,
 			posting.fcnoffset,
 			posting.lineoffset,
@@ -246,7 +337,7 @@ long invmake(char *invname, char *invpost, FILE *infile) {
 		fflush(stdout);
 #endif
 	}
-	if(!invnewterm()) { return (0); }
+	if(!invnewterm() || !foldblock()) { return (0); }
 	/* now clean up final block  */
 	logicalblk.invblk[0] = numinvitems;
 	/* loops pointer around to start */
@@ -269,16 +360,33 @@ long invmake(char *invname, char *invpost, FILE *infile) {
 		goto cannotwrite;
 	}
 	/* save the size for reference later */
-	nextsupfing = sizeof(long) + sizeof(long) * numlogblk + (supfing - SUPFING);
+	nextsupfing = WORDSIZE + WORDSIZE * numlogblk + (supfing - SUPFING);
 	/* make sure the file ends at a logical block boundary.  This is
 	necessary for invinsert to correctly create extended blocks
 	 */
 	i = nextsupfing % sizeof(t_logicalblk);
 	/* write out junk to fill log blk */
-	if(fwrite(temp, sizeof(t_logicalblk) - i, 1, outfile) == 0 ||
-		fflush(outfile) == EOF) { /* rewind doesn't check for write failure */
+	if(fwrite(temp, sizeof(t_logicalblk) - i, 1, outfile) == 0) { goto cannotwrite; }
+	/* the case-folded term table follows */
+	param.foldstart = ftell(outfile);
+	if(putfold() == false) {
+		foldfree();
+		goto cannotwrite;
+	}
+	param.foldsize = ftell(outfile) - param.foldstart;
+	/* and then the trigram table of its terms, on a word boundary */
+	if(param.foldsize % WORDSIZE != 0
+	&& fwrite(temp, WORDSIZE - param.foldsize % WORDSIZE, 1, outfile) == 0) {
+		foldfree();
 		goto cannotwrite;
 	}
+	param.gramstart = ftell(outfile);
+	if(putgrams() == false || fflush(outfile) == EOF) { /* rewind doesn't check for write failure */
+		foldfree();
+		goto cannotwrite;
+	}
+	param.gramsize = ftell(outfile) - param.gramstart;
+	foldfree();
 	/* write the control area */
 	rewind(outfile);
 	param.version	= FMTVERSION;
@@ -291,14 +399,14 @@ long invmake(char *invname, char *invpost, FILE *infile) {
 	param.share	   = 0;
 	if(fwrite(&param, sizeof(param), 1, outfile) == 0) { goto cannotwrite; }
 	for(i = 0; i < 10; i++) /* for future use */
-		if(fwrite(&zerolong, sizeof(zerolong), 1, outfile) == 0) { goto cannotwrite; }
+		if(fwrite(&zeroword, sizeof(zeroword), 1, outfile) == 0) { goto cannotwrite; }
 
 	/* make first block loop backwards to last block */
 	if(fflush(outfile) == EOF) { /* fseek doesn't check for write failure */
 		goto cannotwrite;
 	}
 	/* get to second word first block */
-	fseek(outfile, BUFSIZ + 2 * sizeof(long), SEEK_SET);
+	fseek(outfile, BUFSIZ + 2 * WORDSIZE, SEEK_SET);
 	tlong = numlogblk - 1;
 	if(fwrite(&tlong, sizeof(tlong), 1, outfile) == 0 || fclose(outfile) == EOF) {
 	cannotwrite:
@@ -342,8 +450,8 @@ static int invnewterm(void) {
 	char		*tptr, *tptr3;
 
 	union {
-			unsigned long packword[2];
-			ENTRY		  e;
+			int64_t packword[2];
+			ENTRY	e;
 	} iteminfo;
 
 	gooditems = 0; /* initialize, to avoid warning */
@@ -356,11 +464,11 @@ static int invnewterm(void) {
 		zipf[0]++;
 #endif
 	len = strlen(thisterm);
-	/* length of term rounded up to long boundary */
-	wdlen = (len + (sizeof(long) - 1)) / sizeof(long);
-	/* each term needs 2 longs for its iteminfo and
-	 * 1 long for its offset */
-	numwilluse = (wdlen + 3) * sizeof(long);
+	/* length of term rounded up to word boundary */
+	wdlen = (len + (WORDSIZE - 1)) / WORDSIZE;
+	/* each term needs 2 words for its iteminfo and
+	 * 1 word for its offset */
+	numwilluse = (wdlen + 3) * WORDSIZE;
 	/* new block if at least 1 item in block */
 	if(numinvitems && numwilluse + amtused > sizeof(t_logicalblk)) {
 		/* set up new block */
@@ -403,7 +511,7 @@ static int invnewterm(void) {
 		while(maxback-- > 1) {
 			howfar++;
 			iteminfo.packword[0] =
-				logicalblk.invblk[--holditems * 2 + (sizeof(long) - 1)];
+				logicalblk.invblk[--holditems * 2 + 3];
 			if((i = iteminfo.e.size / 10) < maxback) {
 				maxback	   = i;
 				backupflag = howfar;
@@ -417,12 +525,13 @@ static int invnewterm(void) {
 		logicalblk.invblk[1] = numlogblk + 1;
 		/* set back pointer to last block */
 		logicalblk.invblk[2] = numlogblk - 1;
+		if(foldblock() == false) { return (0); }
 		if(fwrite(logicalblk.chrblk, 1, sizeof(t_logicalblk), outfile) == 0) {
 			invcannotwrite(indexfile);
 			return (0);
 		}
-		/* 3 longs needed for: numinvitems, next block, and previous block */
-		amtused = 3 * sizeof(long);
+		/* 3 words needed for: numinvitems, next block, and previous block */
+		amtused = 3 * WORDSIZE;
 		numlogblk++;
 		/* check if had to back up, if so do it */
 		if(backupflag) {
@@ -454,7 +563,7 @@ static int invnewterm(void) {
 			while(tptr3 > tptr)
 				*--tptr2 = *--tptr3;
 			lastinblk -= j;
-			amtused += ((2 * sizeof(long)) * backupflag + j);
+			amtused += ((2 * WORDSIZE) * backupflag + j);
 			for(i = 3; i < (backupflag * 2 + 2); i += 2) {
 				iteminfo.packword[0] = logicalblk.invblk[i];
 				iteminfo.e.offset += (tptr2 - tptr3);
@@ -473,26 +582,256 @@ static int invnewterm(void) {
 	}
 	/* HBB 20010501: Fixed bug by replacing magic number '8' by
 	 * what it actually represents. */
-	lastinblk -= (numwilluse - 2 * sizeof(long));
+	lastinblk -= (numwilluse - 2 * WORDSIZE);
 	iteminfo.e.offset = lastinblk;
 	iteminfo.e.size	  = len;
 	iteminfo.e.space  = 0;
 	iteminfo.e.post	  = numpost;
 	strncpy(logicalblk.chrblk + lastinblk, thisterm, len);
 	amtused += numwilluse;
-	logicalblk.invblk[(lastinblk / sizeof(long)) + wdlen] = nextpost;
-	if((i = postptr - POST) > 0) {
-		if(fwrite(POST, sizeof(*POST), i, fpost) == 0) {
-			invcannotwrite(postingfile);
-			return (0);
-		}
-		nextpost += i * sizeof(*POST);
+	logicalblk.invblk[(lastinblk / WORDSIZE) + wdlen] = nextpost;
+	if((i = postptr - POST) > 0 && putpostings(POST, i) == false) {
+		invcannotwrite(postingfile);
+		return (0);
 	}
 	logicalblk.invblk[3 + 2 * numinvitems++] = iteminfo.packword[0];
 	logicalblk.invblk[2 + 2 * numinvitems]	 = iteminfo.packword[1];
 	return (1);
 }
 
+/* add the terms of the block about to be written to the case-folded term table */
+static
+bool foldblock(void) {
+	for(unsigned k = 0; k < numinvitems; ++k) {
+		ENTRY entry = ((ENTRY *)(logicalblk.invblk + 3))[k];
+		char *term	= logicalblk.chrblk + entry.offset;
+
+		if(entry.size == 0) { continue; } /* the null term */
+		if(nfold == foldsize) {
+			foldsize = (foldsize == 0) ? SUPERINC : 2 * foldsize;
+			if((FOLD = realloc(FOLD, foldsize * sizeof(*FOLD))) == NULL) {
+				invcannotalloc(foldsize * sizeof(*FOLD));
+				return false;
+			}
+		}
+		if(foldtextlen + entry.size + 1 > foldtextsize) {
+			foldtextsize = 2 * (foldtextsize + entry.size + 1);
+			if((FOLDTEXT = realloc(FOLDTEXT, foldtextsize)) == NULL) {
+				invcannotalloc(foldtextsize);
+				return false;
+			}
+		}
+		FOLD[nfold].block = numlogblk;
+		FOLD[nfold].item  = k;
+		FOLD[nfold].text  = foldtextlen;
+		for(unsigned j = 0; j < entry.size; ++j) {
+			FOLDTEXT[foldtextlen++] = tolower((unsigned char)term[j]);
+		}
+		FOLDTEXT[foldtextlen++] = '\0';
+		++nfold;
+	}
+	return true;
+}
+
+/* case-folded term order, and then index order */
+static
+int foldcompare(const void *p1, const void *p2) {
+	const FOLDENTRY *f1 = p1, *f2 = p2;
+	int				 n	= strcmp(FOLDTEXT + f1->text, FOLDTEXT + f2->text);
+
+	if(n != 0) { return n; }
+	if(f1->block != f2->block) { return (f1->block < f2->block) ? -1 : 1; }
+	return (f1->item < f2->item) ? -1 : (f1->item > f2->item);
+}
+
+/* sort and write out the case-folded term table */
+static
+bool putfold(void) {
+	int64_t count = nfold;
+	int64_t head  = WORDSIZE + nfold * sizeof(*FOLD);
+
+	qsort(FOLD, nfold, sizeof(*FOLD), foldcompare);
+	for(size_t k = 0; k < nfold; ++k) {
+		FOLD[k].text += head;
+	}
+	return fwrite(&count, sizeof(count), 1, outfile) == 1
+		&& fwrite(FOLD, sizeof(*FOLD), nfold, outfile) == nfold
+		&& fwrite(FOLDTEXT, 1, foldtextlen, outfile) == foldtextlen;
+}
+
+/* free the case-folded term table, once it and its trigrams are written */
+static
+void foldfree(void) {
+	free(FOLD);
+	free(FOLDTEXT);
+	FOLD	 = NULL;
+	FOLDTEXT = NULL;
+	nfold = foldsize = foldtextlen = foldtextsize = 0;
+}
+
+/* the trigram code of the 3 characters at s, or -1 if they are not
+ * all letters, digits or _; letter case is ignored */
+static
+long gramcode(const char *s) {
+	long code = 0;
+
+	for(int i = 0; i < 3; ++i) {
+		int c = tolower((unsigned char)s[i]);
+
+		if(c >= 'a' && c <= 'z') {
+			c = c - 'a' + 1;
+		} else if(c >= '0' && c <= '9') {
+			c = c - '0' + 27;
+		} else if(c == '_') {
+			c = 37;
+		} else {
+			return -1; /* including the null at the end of s */
+		}
+		code = code * GRAMCHARS + c;
+	}
+	return code;
+}
+
+/* write out the trigram table of the sorted case-folded term table;
+ * a first pass sizes the list of each trigram, so that a second can
+ * put each list in place */
+static
+bool putgrams(void) {
+	int64_t		   foldhead = WORDSIZE + nfold * sizeof(*FOLD);
+	int64_t		  *last;	/* the last term put in the list of each trigram */
+	int64_t		  *place;	/* the size of each list, and then its offset */
+	uint32_t	  *count;
+	unsigned char *lists = NULL;
+	unsigned char  varint[VARINTMAX];
+	int64_t		   ngrams = 0, size = 0;
+	GRAMENTRY	   entry;
+	bool		   ok = false;
+
+	last  = malloc(GRAMS * sizeof(*last));
+	place = calloc(GRAMS, sizeof(*place));
+	count = calloc(GRAMS, sizeof(*count));
+	if(last == NULL || place == NULL || count == NULL) {
+		invcannotalloc(GRAMS * sizeof(*last));
+		goto done;
+	}
+	for(int pass = 0; pass < 2; ++pass) {
+		for(long g = 0; g < GRAMS; ++g) {
+			last[g] = -1;
+		}
+		for(size_t k = 0; k < nfold; ++k) {
+			for(const char *s = FOLDTEXT + FOLD[k].text - foldhead; *s != '\0'; ++s) {
+				long g = gramcode(s);
+
+				if(g < 0 || last[g] == (int64_t)k) { continue; }
+				if(pass == 0) {
+					place[g] += putvarint(varint, k - last[g]) - varint;
+					++count[g];
+				} else {
+					place[g] = putvarint(lists + place[g], k - last[g]) - lists;
+				}
+				last[g] = k;
+			}
+		}
+		if(pass == 1) { break; }
+		/* lay out the lists after the entries */
+		for(long g = 0; g < GRAMS; ++g) {
+			if(count[g] > 0) { ++ngrams; }
+		}
+		for(long g = 0; g < GRAMS; ++g) {
+			int64_t n = place[g];
+
+			place[g] = size;
+			size += n;
+		}
+		if((lists = malloc(size + 1)) == NULL) {
+			invcannotalloc(size + 1);
+			goto done;
+		}
+	}
+	if(fwrite(&ngrams, sizeof(ngrams), 1, outfile) != 1) { goto done; }
+	for(long g = 0, list = 0; g < GRAMS; ++g) {
+		if(count[g] == 0) { continue; }
+		entry.gram	= g;
+		entry.count = count[g];
+		entry.list	= WORDSIZE + ngrams * sizeof(entry) + list;
+		list		= place[g]; /* the end of the list, after the second pass */
+		if(fwrite(&entry, sizeof(entry), 1, outfile) != 1) { goto done; }
+	}
+	ok = fwrite(lists, 1, size, outfile) == (size_t)size;
+done:
+	free(lists);
+	free(count);
+	free(place);
+	free(last);
+	return ok;
+}
+
+/* make room for n bytes of compressed postings */
+static
+bool growpostbuf(size_t n) {
+	unsigned char *p;
+
+	if(n <= postbufsize) { return true; }
+	if((p = realloc(postbuf, n)) == NULL) {
+		invcannotalloc(n);
+		return false;
+	}
+	postbuf		= p;
+	postbufsize = n;
+	return true;
+}
+
+static
+unsigned char *putvarint(unsigned char *p, uint64_t v) {
+	while(v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+/* returns NULL for a varint that runs past end */
+static
+const unsigned char *getvarint(const unsigned char *p, const unsigned char *end, uint64_t *v) {
+	*v = 0;
+	for(int shift = 0; p < end && shift < 64; shift += 7) {
+		*v |= (uint64_t)(*p & 0x7f) << shift;
+		if((*p++ & 0x80) == 0) { return p; }
+	}
+	return NULL;
+}
+
+/* compress the postings of a term to the posting file */
+static
+bool putpostings(POSTING *postings, long n) {
+	unsigned char  head[2 * VARINTMAX];
+	unsigned char *p, *h;
+	size_t		   datasize;
+	POSTING		   prev = { 0 };
+
+	if(growpostbuf(n * 3 * VARINTMAX) == false) { return false; }
+	p = postbuf;
+	for(long i = 0; i < n; ++i) {
+		POSTING *posting = &postings[i];
+		int64_t	 d		 = posting->lineoffset - posting->fcnoffset;
+
+		p = putvarint(p, posting->lineoffset - prev.lineoffset);
+		p = putvarint(p, ((uint64_t)(posting->fileindex - prev.fileindex) << 8) | (posting->type & 0xff));
+		p = putvarint(p, posting->fcnoffset == 0 ? 0 : (((uint64_t)d << 1) ^ (uint64_t)(d >> 63)) + 1);
+		prev = *posting;
+	}
+	/* put the size and an empty skip table in front of the postings */
+	datasize = p - postbuf;
+	h		 = putvarint(putvarint(head, datasize), 0);
+	if(fwrite(head, 1, h - head, fpost) != (size_t)(h - head)
+	|| fwrite(postbuf, 1, datasize, fpost) != datasize) {
+		return false;
+	}
+	nextpost += (h - head) + datasize;
+	return true;
+}
+
 /*
  * If 'invname' ends with the 'from' substring, it is replaced inline with the
  * 'to' substring (which must be of the exact same length), and the function
@@ -549,6 +888,10 @@ static FILE *open_file_with_possibly_flipped_name(char *name, const char *flip1,
 
 int invopen(INVCONTROL *invcntl, char *invname, char *invpost, int stat) {
 	int read_index;
+	union {
+			PARAM  param;
+			PARAM1 param1;
+	} head;
 
 	invcntl->invfile =
 		open_file_with_possibly_flipped_name(invname, INVNAME, INVNAME2, stat);
@@ -556,19 +899,33 @@ int invopen(INVCONTROL *invcntl, char *invname, char *invpost, int stat) {
 		invcannotopen(invname);
 		return (-1);
 	}
-	if(fread(&invcntl->param, sizeof(invcntl->param), 1, invcntl->invfile) == 0) {
+	if(fread(&head, sizeof(head), 1, invcntl->invfile) == 0) {
 		fprintf(stderr, PROGRAM_NAME ": empty inverted file\n");
 		fclose(invcntl->invfile);
 		return (-1);
 	}
-	if(invcntl->param.version != FMTVERSION) {
+	if(head.param.version == FMTVERSION || head.param.version == FMTVERSION2) {
+		invcntl->param = head.param;
+		assert(invcntl->param.sizeblk == sizeof(t_logicalblk));
+	} else if(head.param1.version == FMTVERSION1) {
+		invcntl->param.version	 = head.param1.version;
+		invcntl->param.filestat	 = head.param1.filestat;
+		invcntl->param.sizeblk	 = head.param1.sizeblk;
+		invcntl->param.startbyte = head.param1.startbyte;
+		invcntl->param.supsize	 = head.param1.supsize;
+		invcntl->param.cntlsize	 = head.param1.cntlsize;
+		invcntl->param.share	 = head.param1.share;
+		invcntl->param.foldstart = 0;
+		invcntl->param.foldsize	 = 0;
+		invcntl->param.gramstart = 0;
+		invcntl->param.gramsize	 = 0;
+	} else {
 		fprintf(stderr,
 			PROGRAM_NAME
 			": cannot read old index format; use -U option to force database to rebuild\n");
 		fclose(invcntl->invfile);
 		return (-1);
 	}
-	assert(invcntl->param.sizeblk == sizeof(t_logicalblk));
 
 	if(stat == 0 && invcntl->param.filestat == INVALONE) {
 		fprintf(stderr, PROGRAM_NAME ": inverted file is locked\n");
@@ -584,6 +941,35 @@ int invopen(INVCONTROL *invcntl, char *invname, char *invpost, int stat) {
 		return (-1);
 	}
 
+	/* a read-only index is used in place, from the page cache that all
+	   processes reading it share */
+	invcntl->invmap	   = NULL;
+	invcntl->postmap   = NULL;
+	invcntl->foldindex	= NULL;
+	invcntl->gramindex	= NULL;
+	invcntl->gramterms	= NULL;
+	invcntl->ngramterms = 0;
+	if(stat == 0) { invmapfiles(invcntl); }
+	if(invcntl->invmap != NULL) {
+		invcntl->logblk = (union logicalblk *)(invcntl->invmap + invcntl->param.cntlsize);
+		invcntl->iindex = invcntl->invmap + invcntl->param.startbyte;
+		invcntl->numblk = -1;
+		if(invcntl->param.foldsize >= (int64_t)WORDSIZE
+		&& invcntl->param.foldstart + invcntl->param.foldsize <= (int64_t)invcntl->invmapsize) {
+			invcntl->foldindex = invcntl->invmap + invcntl->param.foldstart;
+		}
+		if(foldcount(invcntl) < 0) { invcntl->foldindex = NULL; }
+		if(invcntl->param.gramsize >= (int64_t)WORDSIZE
+		&& invcntl->param.gramstart + invcntl->param.gramsize <= (int64_t)invcntl->invmapsize) {
+			invcntl->gramindex = invcntl->invmap + invcntl->param.gramstart;
+		}
+		if(gramcount(invcntl) < 0) { invcntl->gramindex = NULL; }
+		if(boolready() == -1) {
+			invclose(invcntl);
+			return (-1);
+		}
+		return (1);
+	}
 	/* allocate core for a logical block  */
 	if((invcntl->logblk = malloc((size_t)invcntl->param.sizeblk)) == NULL) {
 		invcannotalloc((size_t)invcntl->param.sizeblk);
@@ -636,6 +1022,24 @@ int invopen(INVCONTROL *invcntl, char *invname, char *invpost, int stat) {
 		fseek(invcntl->invfile, invcntl->param.startbyte, SEEK_SET);
 		fread(invcntl->iindex, (int)invcntl->param.supsize, 1, invcntl->invfile);
 	}
+	/* read in any case-folded term table; caseless searches do without */
+	if(invcntl->param.foldsize >= (int64_t)WORDSIZE
+	&& (invcntl->foldindex = malloc((size_t)invcntl->param.foldsize)) != NULL
+	&& (fseek(invcntl->invfile, invcntl->param.foldstart, SEEK_SET) == -1
+	|| fread(invcntl->foldindex, (size_t)invcntl->param.foldsize, 1, invcntl->invfile) != 1
+	|| foldcount(invcntl) < 0)) {
+		free(invcntl->foldindex);
+		invcntl->foldindex = NULL;
+	}
+	/* and its trigram table, without which searches walk the terms */
+	if(invcntl->param.gramsize >= (int64_t)WORDSIZE
+	&& (invcntl->gramindex = malloc((size_t)invcntl->param.gramsize)) != NULL
+	&& (fseek(invcntl->invfile, invcntl->param.gramstart, SEEK_SET) == -1
+	|| fread(invcntl->gramindex, (size_t)invcntl->param.gramsize, 1, invcntl->invfile) != 1
+	|| gramcount(invcntl) < 0)) {
+		free(invcntl->gramindex);
+		invcntl->gramindex = NULL;
+	}
 	invcntl->numblk = -1;
 	if(boolready() == -1) {
 		fclose(invcntl->postfile);
@@ -644,20 +1048,74 @@ int invopen(INVCONTROL *invcntl, char *invname, char *invpost, int stat) {
 	}
 	/* write back out the control block if anything changed */
 	invcntl->param.filestat = stat;
-	if(stat > invcntl->param.filestat) {
-		rewind(invcntl->invfile);
-		fwrite(&invcntl->param, sizeof(invcntl->param), 1, invcntl->invfile);
-	}
+	if(stat > invcntl->param.filestat) { putparam(invcntl); }
 	return (1);
 }
 
+/* map the inverted file, and the posting file if its lists are compressed;
+ * either is left to stdio if it cannot be mapped */
+static
+void invmapfiles(INVCONTROL *invcntl) {
+	struct stat st;
+	char	   *p;
+
+	if(fstat(fileno(invcntl->invfile), &st) == 0
+	&& invcntl->param.cntlsize + invcntl->param.sizeblk <= st.st_size
+	&& invcntl->param.startbyte + invcntl->param.supsize <= st.st_size
+	&& (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(invcntl->invfile), 0)) != MAP_FAILED) {
+		invcntl->invmap		= p;
+		invcntl->invmapsize = st.st_size;
+	}
+	if(invcntl->param.version == FMTVERSION && fstat(fileno(invcntl->postfile), &st) == 0
+	&& st.st_size > 0
+	&& (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(invcntl->postfile), 0)) != MAP_FAILED) {
+		invcntl->postmap	 = p;
+		invcntl->postmapsize = st.st_size;
+	}
+}
+
+/* make logical block n the one in core; a mapped block is used in place */
+static
+void invblock(INVCONTROL *invcntl, long n) {
+	int64_t start = n * invcntl->param.sizeblk + invcntl->param.cntlsize;
+
+	invcntl->numblk = n;
+	if(invcntl->invmap != NULL) {
+		if(start >= invcntl->param.cntlsize
+		&& start + invcntl->param.sizeblk <= (int64_t)invcntl->invmapsize) {
+			invcntl->logblk = (union logicalblk *)(invcntl->invmap + start);
+		}
+		return;
+	}
+	fseek(invcntl->invfile, start, SEEK_SET);
+	fread(invcntl->logblk, (int)invcntl->param.sizeblk, 1, invcntl->invfile);
+}
+
+/* write back the control block, in the layout of the index version */
+static
+size_t putparam(INVCONTROL *invcntl) {
+	PARAM1 param1;
+
+	rewind(invcntl->invfile);
+	if(invcntl->param.version != FMTVERSION1) {
+		return fwrite(&invcntl->param, sizeof(invcntl->param), 1, invcntl->invfile);
+	}
+	param1.version	 = invcntl->param.version;
+	param1.filestat	 = invcntl->param.filestat;
+	param1.sizeblk	 = invcntl->param.sizeblk;
+	param1.startbyte = invcntl->param.startbyte;
+	param1.supsize	 = invcntl->param.supsize;
+	param1.cntlsize	 = invcntl->param.cntlsize;
+	param1.share	 = invcntl->param.share;
+	return fwrite(&param1, sizeof(param1), 1, invcntl->invfile);
+}
+
 /** invclose must be called to wrap things up and deallocate core  **/
 void invclose(INVCONTROL *invcntl) {
 	/* write out the control block in case anything changed */
 	if(invcntl->param.filestat > 0) {
 		invcntl->param.filestat = 0;
-		rewind(invcntl->invfile);
-		fwrite(&invcntl->param, 1, sizeof(invcntl->param), invcntl->invfile);
+		putparam(invcntl);
 	}
 	if(invcntl->param.filestat == INVALONE) {
 		/* write out the super finger */
@@ -666,6 +1124,14 @@ void invclose(INVCONTROL *invcntl) {
 	}
 	fclose(invcntl->invfile);
 	fclose(invcntl->postfile);
+	free(invcntl->gramterms);
+	if(invcntl->postmap != NULL) { munmap(invcntl->postmap, invcntl->postmapsize); }
+	if(invcntl->invmap != NULL) {
+		munmap(invcntl->invmap, invcntl->invmapsize);
+		return;
+	}
+	free(invcntl->foldindex);
+	free(invcntl->gramindex);
 #if SHARE
 	if(invcntl->param.share > 0) {
 		shmdt(invcntl->iindex);
@@ -676,22 +1142,164 @@ void invclose(INVCONTROL *invcntl) {
 	free(invcntl->logblk);
 }
 
+/* word i of the logical block in core */
+static
+int64_t blockword(INVCONTROL *invcntl, long i) {
+	if(invcntl->param.version == FMTVERSION1) { return ((long *)invcntl->logblk)[i]; }
+	return invcntl->logblk->invblk[i];
+}
+
+/* word i of the superfinger: the number of blocks, then their term offsets */
+static
+int64_t superword(INVCONTROL *invcntl, long i) {
+	if(invcntl->param.version == FMTVERSION1) { return ((unsigned long *)invcntl->iindex)[i]; }
+	return ((int64_t *)invcntl->iindex)[i];
+}
+
+/* entry n of the logical block in core; they follow its 3 header words */
+static
+ENTRY getentry(INVCONTROL *invcntl, long n) {
+	ENTRY1 *entry1;
+	ENTRY	entry;
+
+	if(invcntl->param.version != FMTVERSION1) {
+		return ((ENTRY *)(invcntl->logblk->invblk + 3))[n];
+	}
+	entry1		= (ENTRY1 *)((long *)invcntl->logblk + 3) + n;
+	entry.offset = (unsigned short)entry1->offset;
+	entry.size	 = entry1->size;
+	entry.space	 = entry1->space;
+	entry.post	 = entry1->post;
+	return entry;
+}
+
+/* the posting file offset stored in the word after the entry's term */
+static
+int64_t postingsoffset(INVCONTROL *invcntl, ENTRY *entry) {
+	char *ptr = invcntl->logblk->chrblk + entry->offset;
+
+	if(invcntl->param.version == FMTVERSION1) {
+		return ((long *)ptr)[(entry->size + (sizeof(long) - 1)) / sizeof(long)];
+	}
+	return ((int64_t *)ptr)[(entry->size + (WORDSIZE - 1)) / WORDSIZE];
+}
+
+/* read the next n postings from the posting file */
+static
+size_t readpostings(INVCONTROL *invcntl, POSTING *postings, size_t n) {
+	POSTING1 postings1[SETINC];
+	size_t	 done = 0;
+
+	if(invcntl->param.version != FMTVERSION1) {
+		return fread(postings, sizeof(*postings), n, invcntl->postfile);
+	}
+	while(done < n) {
+		size_t want = n - done < SETINC ? n - done : SETINC;
+		size_t got	= fread(postings1, sizeof(*postings1), want, invcntl->postfile);
+
+		for(size_t i = 0; i < got; ++i, ++done) {
+			postings[done].lineoffset = postings1[i].lineoffset;
+			postings[done].fcnoffset  = postings1[i].fcnoffset;
+			postings[done].fileindex  = postings1[i].fileindex;
+			postings[done].type		  = postings1[i].type;
+		}
+		if(got < want) { break; }
+	}
+	return done;
+}
+
+/* position the cursor before the first posting of the entry;
+ * a compressed list is read in whole */
+static
+bool postfirst(INVCONTROL *invcntl, ENTRY *entry, POSTCURSOR *cur) {
+	const unsigned char *list, *p;
+	uint64_t			 datasize, skipsize;
+	size_t				 got, head, size;
+	int64_t				 offset;
+
+	memset(cur, 0, sizeof(*cur));
+	cur->invcntl = invcntl;
+	offset		 = postingsoffset(invcntl, entry);
+	if(invcntl->postmap != NULL) {
+		/* the list is used in place */
+		if(offset < 0 || (uint64_t)offset > invcntl->postmapsize) { return false; }
+		list = (unsigned char *)invcntl->postmap + offset;
+		got	 = invcntl->postmapsize - offset;
+	} else {
+		if(fseek(invcntl->postfile, offset, SEEK_SET) == -1) { return false; }
+		if(invcntl->param.version != FMTVERSION) {
+			cur->left = entry->post;
+			return true;
+		}
+		if(growpostbuf(2 * VARINTMAX) == false) { return false; }
+		got	 = fread(postbuf, 1, 2 * VARINTMAX, invcntl->postfile);
+		list = postbuf;
+	}
+	if((p = getvarint(list, list + got, &datasize)) == NULL
+	|| datasize > (uint64_t)entry->post * 3 * VARINTMAX
+	|| (p = getvarint(p, list + got, &skipsize)) == NULL
+	|| skipsize > (uint64_t)entry->post * 3 * VARINTMAX) {
+		return false;
+	}
+	/* the skip table is not used */
+	head = (p - list) + skipsize;
+	size = head + datasize;
+	if(size > got) {
+		if(invcntl->postmap != NULL || growpostbuf(size) == false
+		|| fread(postbuf + got, 1, size - got, invcntl->postfile) != size - got) {
+			return false;
+		}
+		list = postbuf;
+	}
+	cur->left = entry->post;
+	cur->data = list + head;
+	cur->end  = cur->data + datasize;
+	return true;
+}
+
+/* read the next posting; false at the end of the list */
+static
+bool postnext(POSTCURSOR *cur, POSTING *posting) {
+	uint64_t line, filetype, fcn;
+
+	if(cur->left <= 0) { return false; }
+	if(cur->data == NULL) {
+		if(readpostings(cur->invcntl, posting, 1) != 1) {
+			cur->left = 0;
+			return false;
+		}
+		--cur->left;
+		return true;
+	}
+	if((cur->data = getvarint(cur->data, cur->end, &line)) == NULL
+	|| (cur->data = getvarint(cur->data, cur->end, &filetype)) == NULL
+	|| (cur->data = getvarint(cur->data, cur->end, &fcn)) == NULL) {
+		cur->left = 0;
+		return false;
+	}
+	cur->last.lineoffset += line;
+	cur->last.fileindex += filetype >> 8;
+	cur->last.type = filetype & 0xff;
+	if(fcn == 0) {
+		cur->last.fcnoffset = 0;
+	} else {
+		--fcn;
+		cur->last.fcnoffset = cur->last.lineoffset - (int64_t)((fcn >> 1) ^ -(fcn & 1));
+	}
+	--cur->left;
+	*posting = cur->last;
+	return true;
+}
+
 /** invstep steps the inverted file forward one item **/
 static void invstep(INVCONTROL *invcntl) {
-	if(invcntl->keypnt < (invcntl->logblk->invblk[0] - 1)) {
+	if(invcntl->keypnt < (blockword(invcntl, 0) - 1)) {
 		invcntl->keypnt++;
 		return;
 	}
 
 	/* move forward a block else wrap */
-	invcntl->numblk =
-		invcntl->logblk->invblk[1]; /* was: *(int *)(invcntl->logblk + sizeof(long))*/
-
-	/* now read in the block  */
-	fseek(invcntl->invfile,
-		invcntl->numblk * invcntl->param.sizeblk + invcntl->param.cntlsize,
-		SEEK_SET);
-	fread(invcntl->logblk, (int)invcntl->param.sizeblk, 1, invcntl->invfile);
+	invblock(invcntl, blockword(invcntl, 1));
 	invcntl->keypnt = 0;
 }
 
@@ -699,8 +1307,7 @@ static void invstep(INVCONTROL *invcntl) {
 int invforward(INVCONTROL *invcntl) {
 	invstep(invcntl);
 	/* skip things with 0 postings */
-	/* FIXME HBB: magic number alert! (3) */
-	while(((ENTRY *)(invcntl->logblk->invblk + 3) + invcntl->keypnt)->post == 0) {
+	while(getentry(invcntl, invcntl->keypnt).post == 0) {
 		invstep(invcntl);
 	}
 	/* Check for having wrapped - reached start of inverted file! */
@@ -710,36 +1317,54 @@ int invforward(INVCONTROL *invcntl) {
 
 /**  invterm gets the present term from the present logical block  **/
 long invterm(INVCONTROL *invcntl, char *term) {
-	ENTRY *entryptr;
+	ENTRY entry = getentry(invcntl, invcntl->keypnt);
+
+	if(entry.size >= TERMMAX) { entry.size = TERMMAX - 1; }
+	strncpy(term, invcntl->logblk->chrblk + entry.offset, (int)entry.size);
+	*(term + entry.size) = '\0';
+	return (entry.post);
+}
+
+/** invpostings reads the postings of the present term  **/
+long invpostings(INVCONTROL *invcntl, POSTING *postings) {
+	ENTRY entry = getentry(invcntl, invcntl->keypnt);
 
-	/* FIXME HBB: magic number alert! (3) */
-	entryptr = (ENTRY *)(invcntl->logblk->invblk + 3) + invcntl->keypnt;
-	strncpy(term, invcntl->logblk->chrblk + entryptr->offset, (int)entryptr->size);
-	*(term + entryptr->size) = '\0';
-	return (entryptr->post);
+	if(entrypostings(invcntl, &entry, postings) == false) { return (-1); }
+	return (entry.post);
+}
+
+/* read all the postings of an entry, uncompressed ones in a single read */
+static
+bool entrypostings(INVCONTROL *invcntl, ENTRY *entry, POSTING *postings) {
+	POSTCURSOR cur;
+
+	if(postfirst(invcntl, entry, &cur) == false) { return false; }
+	if(cur.data == NULL) {
+		return readpostings(invcntl, postings, entry->post) == (size_t)entry->post;
+	}
+	for(long i = 0; i < entry->post; ++i) {
+		if(postnext(&cur, &postings[i]) == false) { return false; }
+	}
+	return true;
 }
 
 /** invfind searches for an individual item in the inverted file  **/
 long invfind(INVCONTROL *invcntl, char *searchterm) /* term being searched for  */
 {
-	int			   imid, ilow, ihigh;
-	long		   num;
-	int			   i;
-	unsigned long *intptr, *intptr2;
-	ENTRY		  *entryptr;
+	int	  imid, ilow, ihigh;
+	long  num;
+	int	  i;
+	ENTRY entry;
 
 	/* make sure it is initialized via invready  */
 	if(invcntl->invfile == 0) return (-1L);
 
 	/* now search for the appropriate finger block */
-	intptr = (unsigned long *)invcntl->iindex;
-
 	ilow  = 0;
-	ihigh = *intptr++ - 1;
+	ihigh = superword(invcntl, 0) - 1;
 	while(ilow <= ihigh) {
-		imid	= (ilow + ihigh) / 2;
-		intptr2 = intptr + imid;
-		i		= strcmp(searchterm, (invcntl->iindex + *intptr2));
+		imid = (ilow + ihigh) / 2;
+		i	 = strcmp(searchterm, (invcntl->iindex + superword(invcntl, imid + 1)));
 		if(i < 0)
 			ihigh = imid - 1;
 		else if(i > 0)
@@ -755,40 +1380,31 @@ long invfind(INVCONTROL *invcntl, char *searchterm) /* term being searched for
 	/* fetch the appropriate logical block if not in core  */
 	/* note always fetch it if the file is busy */
 	if((imid != invcntl->numblk) || (invcntl->param.filestat >= INVBUSY)) {
-		fseek(invcntl->invfile,
-			(imid * invcntl->param.sizeblk) + invcntl->param.cntlsize,
-			SEEK_SET);
-		invcntl->numblk = imid;
-		fread(invcntl->logblk, (int)invcntl->param.sizeblk, 1, invcntl->invfile);
+		invblock(invcntl, imid);
 	}
 
 srch_ext:
 	/* now find the term in this block. tricky this  */
-	intptr = (unsigned long *)invcntl->logblk->invblk;
-
 	ilow  = 0;
-	ihigh = *intptr - 1;
-	intptr += 3;
-	num = 0;
+	ihigh = blockword(invcntl, 0) - 1;
+	num	  = 0;
 	while(ilow <= ihigh) {
-		imid	 = (ilow + ihigh) / 2;
-		entryptr = (ENTRY *)intptr + imid;
-		i		 = strncmp(searchterm,
-			   invcntl->logblk->chrblk + entryptr->offset,
-			   (int)entryptr->size);
-		if(i == 0) i = strlen(searchterm) - entryptr->size;
+		imid  = (ilow + ihigh) / 2;
+		entry = getentry(invcntl, imid);
+		i	  = strncmp(searchterm, invcntl->logblk->chrblk + entry.offset, (int)entry.size);
+		if(i == 0) i = strlen(searchterm) - entry.size;
 		if(i < 0)
 			ihigh = imid - 1;
 		else if(i > 0)
 			ilow = ++imid;
 		else {
-			num = entryptr->post;
+			num = entry.post;
 			break;
 		}
 	}
 	/* be careful about case where searchterm is after last in this block  */
-	if(imid >= invcntl->logblk->invblk[0]) {
-		invcntl->keypnt = invcntl->logblk->invblk[0];
+	if(imid >= blockword(invcntl, 0)) {
+		invcntl->keypnt = blockword(invcntl, 0);
 		invstep(invcntl);
 		/* note if this happens the term could be in extended block */
 		if(invcntl->param.startbyte < invcntl->numblk * invcntl->param.sizeblk)
@@ -798,62 +1414,235 @@ srch_ext:
 	return (num);
 }
 
+/* number of terms in the case-folded term table, or -1 if it is unusable */
+static
+long foldcount(INVCONTROL *invcntl) {
+	int64_t count;
+
+	if(invcntl->foldindex == NULL) { return -1; }
+	count = *(int64_t *)invcntl->foldindex;
+	if(count < 0 || count > (invcntl->param.foldsize - (int64_t)WORDSIZE) / (int64_t)sizeof(FOLDENTRY)) {
+		return -1;
+	}
+	return count;
+}
+
+/** invfoldfind finds the first case-folded term >= the lower case searchterm;
+ ** returns -1 if the index has no case-folded term table **/
+long invfoldfind(INVCONTROL *invcntl, char *searchterm) {
+	FOLDENTRY *fold = (FOLDENTRY *)(invcntl->foldindex + WORDSIZE);
+	long	   ilow, ihigh, imid, count;
+
+	if((count = foldcount(invcntl)) < 0) { return (-1); }
+	ilow  = 0;
+	ihigh = count;
+	while(ilow < ihigh) {
+		imid = (ilow + ihigh) / 2;
+		if(fold[imid].text < 0 || fold[imid].text >= invcntl->param.foldsize
+		|| strcmp(invcntl->foldindex + fold[imid].text, searchterm) < 0) {
+			ilow = imid + 1;
+		} else {
+			ihigh = imid;
+		}
+	}
+	invcntl->foldpnt = ilow;
+	return (ilow < count);
+}
+
+/** invfoldforward moves forward one case-folded term; 0 past the last **/
+int invfoldforward(INVCONTROL *invcntl) {
+	return ++invcntl->foldpnt < foldcount(invcntl);
+}
+
+/** invfoldterm gets the present case-folded term and makes its
+ ** term the present one, for boolfile() and invpostings() **/
+long invfoldterm(INVCONTROL *invcntl, char *term) {
+	FOLDENTRY *fold = (FOLDENTRY *)(invcntl->foldindex + WORDSIZE) + invcntl->foldpnt;
+
+	*term = '\0';
+	if(invcntl->foldpnt < 0 || invcntl->foldpnt >= foldcount(invcntl)) { return (0); }
+	if(fold->text >= 0 && fold->text < invcntl->param.foldsize) {
+		snprintf(term, TERMMAX, "%.*s",
+			(int)(invcntl->param.foldsize - fold->text),
+			invcntl->foldindex + fold->text);
+	}
+	if(fold->block != invcntl->numblk) { invblock(invcntl, fold->block); }
+	invcntl->keypnt = fold->item;
+	if(invcntl->keypnt >= blockword(invcntl, 0)) {
+		invcntl->keypnt = 0;
+		return (0);
+	}
+	return (getentry(invcntl, invcntl->keypnt).post);
+}
+
+/* number of trigrams in the trigram table, or -1 if it is unusable;
+ * its term lists are of the case-folded term table, so it needs that */
+static
+long gramcount(INVCONTROL *invcntl) {
+	int64_t count;
+
+	if(invcntl->gramindex == NULL || foldcount(invcntl) < 0) { return -1; }
+	count = *(int64_t *)invcntl->gramindex;
+	if(count < 0 || count > (invcntl->param.gramsize - (int64_t)WORDSIZE) / (int64_t)sizeof(GRAMENTRY)) {
+		return -1;
+	}
+	return count;
+}
+
+/** invgramfind finds the case-folded terms with every trigram of the
+ ** literal strings, which all the terms a search matches contain;
+ ** returns their number, or -1 if the index has no trigram table or
+ ** the literals have no trigram, so that the terms must be walked **/
+long invgramfind(INVCONTROL *invcntl, char **literal, int n) {
+	GRAMENTRY *gram = (GRAMENTRY *)(invcntl->gramindex + WORDSIZE);
+	GRAMENTRY *want[GRAMFIND];
+	long	   ngrams, nwant = 0, nfolds;
+
+	free(invcntl->gramterms);
+	invcntl->gramterms	= NULL;
+	invcntl->ngramterms = 0;
+	invcntl->grampnt	= 0;
+	if((ngrams = gramcount(invcntl)) < 0) { return (-1); }
+	nfolds = foldcount(invcntl);
+
+	/* look up the trigrams, keeping the ones with the fewest terms */
+	for(int i = 0; i < n; ++i) {
+		for(char *s = literal[i]; *s != '\0'; ++s) {
+			long	   code = gramcode(s), ilow = 0, ihigh = ngrams, imid;
+			GRAMENTRY *e;
+			int		   j;
+
+			if(code < 0) { continue; }
+			while(ilow < ihigh) {
+				imid = (ilow + ihigh) / 2;
+				if(gram[imid].gram < code) {
+					ilow = imid + 1;
+				} else {
+					ihigh = imid;
+				}
+			}
+			if(ilow == ngrams || gram[ilow].gram != code) { return (0); } /* no term has it */
+			e = gram + ilow;
+			for(j = 0; j < nwant && want[j] != e; ++j) {
+				;
+			}
+			if(j < nwant) { continue; }
+			if(nwant < GRAMFIND) {
+				want[nwant++] = e;
+				continue;
+			}
+			for(j = 0; j < nwant; ++j) {
+				if(want[j]->count > e->count) {
+					GRAMENTRY *t = want[j];
+
+					want[j] = e;
+					e		= t;
+				}
+			}
+		}
+	}
+	if(nwant == 0) { return (-1); }
+	/* start from the shortest list */
+	for(int j = 1; j < nwant; ++j) {
+		if(want[j]->count < want[0]->count) {
+			GRAMENTRY *t = want[0];
+
+			want[0] = want[j];
+			want[j] = t;
+		}
+	}
+
+	/* intersect the term lists */
+	if((invcntl->gramterms = malloc((want[0]->count + 1) * sizeof(*invcntl->gramterms))) == NULL) {
+		invcannotalloc((want[0]->count + 1) * sizeof(*invcntl->gramterms));
+		return (-1);
+	}
+	for(int j = 0; j < nwant && (j == 0 || invcntl->ngramterms > 0); ++j) {
+		const unsigned char *p	 = (unsigned char *)invcntl->gramindex + want[j]->list;
+		const unsigned char *end = (unsigned char *)invcntl->gramindex + invcntl->param.gramsize;
+		long				 have = invcntl->ngramterms, k = 0;
+		int64_t				 term = -1;
+		uint64_t			 delta;
+
+		if(want[j]->list < 0 || want[j]->list > invcntl->param.gramsize) { p = end; }
+		invcntl->ngramterms = 0;
+		for(uint32_t m = 0; m < want[j]->count; ++m) {
+			if((p = getvarint(p, end, &delta)) == NULL || (term += delta) >= nfolds) { break; }
+			if(j == 0) {
+				invcntl->gramterms[invcntl->ngramterms++] = term;
+				continue;
+			}
+			while(k < have && invcntl->gramterms[k] < term) {
+				++k;
+			}
+			if(k == have) { break; }
+			if(invcntl->gramterms[k] == term) { invcntl->gramterms[invcntl->ngramterms++] = term; }
+		}
+	}
+	return (invcntl->ngramterms);
+}
+
+/** invgramforward moves forward one term found by invgramfind(); 0 past the last **/
+int invgramforward(INVCONTROL *invcntl) {
+	return ++invcntl->grampnt < invcntl->ngramterms;
+}
+
+/** invgramterm gets the present term found by invgramfind()
+ ** and makes it the present one, for boolfile() and invpostings() **/
+long invgramterm(INVCONTROL *invcntl, char *term) {
+	*term = '\0';
+	if(invcntl->grampnt < 0 || invcntl->grampnt >= invcntl->ngramterms) { return (0); }
+	invcntl->foldpnt = invcntl->gramterms[invcntl->grampnt];
+	if(invfoldterm(invcntl, term) == 0) { return (0); }
+	return (invterm(invcntl, term));
+}
+
 #if DEBUG
 
 /** invdump dumps the block the term parameter is in **/
 void invdump(INVCONTROL *invcntl, char *term) {
-	long   i, j, n, *longptr;
-	ENTRY *entryptr;
-	char   temp[512], *ptr;
+	long  i = 0, j, n;
+	ENTRY entry;
+	char  temp[TERMMAX];
 
 	/* dump superindex if term is "-"  */
 	if(*term == '-') {
-		j		= atoi(term + 1);
-		longptr = (long *)invcntl->iindex;
-		n		= *longptr++;
+		j = atoi(term + 1);
+		n = superword(invcntl, 0);
 		printf("Superindex dump, num blocks=%ld\n", n);
-		longptr += j;
-		while((longptr <= ((long *)invcntl->iindex) + n) && invbreak == 0) {
-			printf("%2ld  %6ld %s\n", j++, *longptr, invcntl->iindex + *longptr);
-			longptr++;
+		for(; j < n && invbreak == 0; j++) {
+			printf("%2ld  %6" PRId64 " %s\n",
+				j,
+				superword(invcntl, j + 1),
+				invcntl->iindex + superword(invcntl, j + 1));
 		}
 		return;
 	} else if(*term == '#') {
 		j = atoi(term + 1);
 		/* fetch the appropriate logical block */
-		invcntl->numblk = j;
-		fseek(invcntl->invfile,
-			(j * invcntl->param.sizeblk) + invcntl->param.cntlsize,
-			SEEK_SET);
-		fread(invcntl->logblk, (int)invcntl->param.sizeblk, 1, invcntl->invfile);
+		invblock(invcntl, j);
 	} else
-		i = abs((int)invfind(invcntl, term));
-	longptr = invcntl->logblk->invblk;
-	n		= *longptr++;
-	printf("Entry term to invdump=%s, postings=%ld, forwrd ptr=%ld, back ptr=%ld\n",
+		i = labs(invfind(invcntl, term));
+	n = blockword(invcntl, 0);
+	printf("Entry term to invdump=%s, postings=%ld, forwrd ptr=%" PRId64 ", back ptr=%" PRId64 "\n",
 		term,
 		i,
-		*(longptr),
-		*(longptr + 1));
-	/* FIXME HBB: magic number alert! (3) */
-	entryptr = (ENTRY *)(invcntl->logblk->invblk + 3);
+		blockword(invcntl, 1),
+		blockword(invcntl, 2));
 	printf("%ld terms in this block, block=%ld\n", n, invcntl->numblk);
 	printf("\tterm\t\t\tposts\tsize\toffset\tspace\t1st word\n");
 	for(j = 0; j < n && invbreak == 0; j++) {
-		ptr = invcntl->logblk->chrblk + entryptr->offset;
-		strncpy(temp, ptr, (int)entryptr->size);
-		temp[entryptr->size] = '\0';
-		ptr +=
-			(sizeof(long) * (long)((entryptr->size + (sizeof(long) - 1)) / sizeof(long)));
-		printf("%2ld  %-24s\t%5ld\t%3d\t%d\t%d\t%ld\n",
+		entry = getentry(invcntl, j);
+		strncpy(temp, invcntl->logblk->chrblk + entry.offset, (int)entry.size);
+		temp[entry.size] = '\0';
+		printf("%2ld  %-24s\t%5" PRId64 "\t%3d\t%" PRIu32 "\t%d\t%" PRId64 "\n",
 			j,
 			temp,
-			entryptr->post,
-			entryptr->size,
-			entryptr->offset,
-			entryptr->space,
-			*(long *)ptr);
-		entryptr++;
+			entry.post,
+			entry.size,
+			entry.offset,
+			entry.space,
+			postingsoffset(invcntl, &entry));
 	}
 }
 #endif
@@ -877,6 +1666,24 @@ static int boolready(void) {
 	return (0);
 }
 
+/* make room for n postings in a set, at least doubling it when it grows,
+ * so that merging many terms does not realloc for each of them */
+static
+POSTING *growset(POSTING **set, size_t *size, size_t n) {
+	POSTING *p;
+	size_t	 newsize;
+
+	if(n <= *size) { return *set; }
+	newsize = (2 * *size > n) ? 2 * *size : n;
+	if((p = realloc(*set, newsize * sizeof(**set))) == NULL) {
+		invcannotalloc(newsize * sizeof(**set));
+		return NULL;
+	}
+	*set  = p;
+	*size = newsize;
+	return p;
+}
+
 void boolclear(void) {
 	numitems = 0;
 	item	 = item1;
@@ -884,21 +1691,14 @@ void boolclear(void) {
 }
 
 POSTING *boolfile(INVCONTROL *invcntl, long *num, int boolarg) {
-	ENTRY		  *entryptr;
-	FILE		  *file;
-	void		  *ptr;
-	unsigned long *ptr2;
-	POSTING		  *newitem = NULL; /* initialize, to avoid warning */
-	POSTING		   posting;
-	unsigned	   u;
-	POSTING		  *newsetp = NULL, *set1p;
-	long		   newsetc, set1c, set2c;
-
-	/* FIXME HBB: magic number alert! (3) */
-	entryptr = (ENTRY *)(invcntl->logblk->invblk + 3) + invcntl->keypnt;
-	ptr		 = invcntl->logblk->chrblk + entryptr->offset;
-	ptr2 = ((unsigned long *)ptr) + (entryptr->size + (sizeof(long) - 1)) / sizeof(long);
-	*num = entryptr->post;
+	ENTRY	 entry;
+	POSTING *newitem = NULL; /* initialize, to avoid warning */
+	size_t	 u;
+	POSTING *newsetp = NULL, *set1p, *set1end, *set2p, *set2end;
+	long	 newsetc;
+
+	entry = getentry(invcntl, invcntl->keypnt);
+	*num  = entry.post;
 	switch(boolarg) {
 		case bool_OR:
 		case falseT:
@@ -921,77 +1721,48 @@ POSTING *boolfile(INVCONTROL *invcntl, long *num, int boolarg) {
 		case REVERSEfalseT:
 			u += *num;
 			if(item == item2) {
-				if(u > setsize1) {
-					u += SETINC;
-					if((item1 = realloc(item1, u * sizeof(*item1))) == NULL) {
-						invcannotalloc(u * sizeof(*item1));
-						boolready();
-						*num = -1;
-						return (NULL);
-					}
-					setsize1 = u;
-				}
-				newitem = item1;
+				newitem = growset(&item1, &setsize1, u);
 			} else {
-				if(u > setsize2) {
-					u += SETINC;
-					if((item2 = realloc(item2, u * sizeof(*item2))) == NULL) {
-						invcannotalloc(u * sizeof(*item2));
-						boolready();
-						*num = -1;
-						return (NULL);
-					}
-					setsize2 = u;
-				}
-				newitem = item2;
+				newitem = growset(&item2, &setsize2, u);
+			}
+			if(newitem == NULL) {
+				boolready();
+				*num = -1;
+				return (NULL);
 			}
 			newsetp = newitem;
 	}
-	file = invcntl->postfile;
-	fseek(file, *ptr2, SEEK_SET);
-	fread(&posting, sizeof(posting), 1, file);
 	newsetc = 0;
 	switch(boolarg) {
 		case bool_OR:
-			/* while something in both sets */
+			/* read the term's postings at once and merge the two sorted arrays */
+			if(growset(&termset, &termsetsize, *num) == NULL
+			|| entrypostings(invcntl, &entry, termset) == false) {
+				*num = -1;
+				return (NULL);
+			}
 			set1p	= item;
-			newsetp = newitem;
-			for(set1c = 0, set2c = 0; set1c < numitems && set2c < *num; newsetc++) {
-				if(set1p->lineoffset < posting.lineoffset) {
+			set1end = item + numitems;
+			set2p	= termset;
+			set2end = termset + *num;
+			while(set1p < set1end && set2p < set2end) {
+				if(set1p->lineoffset < set2p->lineoffset
+				|| (set1p->lineoffset == set2p->lineoffset && set1p->type < set2p->type)) {
 					*newsetp++ = *set1p++;
-					set1c++;
-				} else if(set1p->lineoffset > posting.lineoffset) {
-					*newsetp++ = posting;
-					fread(&posting, (int)sizeof(posting), 1, file);
-					set2c++;
-				} else if(set1p->type < posting.type) {
-					*newsetp++ = *set1p++;
-					set1c++;
-				} else if(set1p->type > posting.type) {
-					*newsetp++ = posting;
-					fread(&posting, (int)sizeof(posting), 1, file);
-					set2c++;
+				} else if(set1p->lineoffset > set2p->lineoffset || set1p->type > set2p->type) {
+					*newsetp++ = *set2p++;
 				} else { /* identical postings */
 					*newsetp++ = *set1p++;
-					set1c++;
-					fread(&posting, (int)sizeof(posting), 1, file);
-					set2c++;
-				}
-			}
-			/* find out what ran out and move the rest in */
-			if(set1c < numitems) {
-				newsetc += numitems - set1c;
-				while(set1c++ < numitems) {
-					*newsetp++ = *set1p++;
-				}
-			} else {
-				while(set2c++ < *num) {
-					*newsetp++ = posting;
-					newsetc++;
-					fread(&posting, (int)sizeof(posting), 1, file);
+					set2p++;
 				}
 			}
-			item = newitem;
+			/* move in the rest of the set that did not run out */
+			memcpy(newsetp, set1p, (set1end - set1p) * sizeof(*set1p));
+			newsetp += set1end - set1p;
+			memcpy(newsetp, set2p, (set2end - set2p) * sizeof(*set2p));
+			newsetp += set2end - set2p;
+			newsetc = newsetp - newitem;
+			item	= newitem;
 			break; /* end of bool_OR */
 	}
 	numitems = newsetc;
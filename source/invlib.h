@@ -33,29 +33,18 @@
 #ifndef CSCOPE_INVLIB_H
 #define CSCOPE_INVLIB_H
 
+#include <stdint.h>
 #include <stdio.h>	/* need definition of FILE* */
-#include <limits.h> /* need definition of CHAR_MAX */
 
 /* inverted index definitions */
 
-/* postings temporary file long number coding into characters */
-#if CHAR_MAX == 255
-# define BASE	   223 /* 255 - ' ' */
-# define PRECISION 4   /* maximum digits after converting a long */
-#else
-# if CHAR_MAX == 127   /* assume sign-extension of a char when converted to an int */
-#  define BASE		95 /* 127 - ' ' */
-#  define PRECISION 5  /* maximum digits after converting a long */
-# else
-#  error Need a platform with 8 bits in a char value
-# endif
-#endif
-
 /* inverted index access parameters */
 #define INVAVAIL 0
 #define INVBUSY	 1
 #define INVALONE 2
 
+#define TERMMAX 1024 /* term max size, including the null */
+
 /* boolean set operations */
 #define bool_OR		  3
 #define AND			  4
@@ -64,13 +53,17 @@
 
 /* note that the entire first block is for parameters */
 typedef struct {
-		long version;	/* inverted index format version */
-		long filestat;	/* file status word  */
-		long sizeblk;	/* size of logical block in bytes */
-		long startbyte; /* first byte of superfinger */
-		long supsize;	/* size of superfinger in bytes */
-		long cntlsize;	/* size of max cntl space (should be a multiple of BUFSIZ) */
-		long share;		/* flag whether to use shared memory */
+		int64_t version;   /* inverted index format version */
+		int64_t filestat;  /* file status word  */
+		int64_t sizeblk;   /* size of logical block in bytes */
+		int64_t startbyte; /* first byte of superfinger */
+		int64_t supsize;   /* size of superfinger in bytes */
+		int64_t cntlsize;  /* size of max cntl space (should be a multiple of BUFSIZ) */
+		int64_t share;	   /* flag whether to use shared memory */
+		int64_t foldstart; /* first byte of the case-folded term table */
+		int64_t foldsize;  /* its size in bytes, 0 if there is none */
+		int64_t gramstart; /* first byte of the trigram table */
+		int64_t gramsize;  /* its size in bytes, 0 if there is none */
 } PARAM;
 
 typedef struct {
@@ -81,22 +74,39 @@ typedef struct {
 		union logicalblk *logblk;	/* ptr to space for a logical block */
 		long			  numblk;	/* number of block presently at *logblk */
 		long			  keypnt;	/* number item in present block found */
+		char			 *invmap;	/* the inverted file mapped read-only, or NULL */
+		size_t			  invmapsize;
+		char			 *postmap;	/* the posting file mapped read-only, or NULL */
+		size_t			  postmapsize;
+		char			 *foldindex; /* ptr to the case-folded term table, or NULL */
+		long			  foldpnt;	 /* its entry found */
+		char			 *gramindex; /* ptr to the trigram table, or NULL */
+		uint32_t		 *gramterms; /* case-folded term table entries found with it */
+		long			  ngramterms;
+		long			  grampnt;	 /* the one of them found */
 } INVCONTROL;
 
 typedef struct {
-		short		  offset; /* offset in this logical block */
-		unsigned char size;	  /* size of term */
-		unsigned char space;  /* number of longs of growth space */
-		long		  post;	  /* number of postings for this entry */
+		uint32_t offset; /* offset in this logical block */
+		uint16_t size;	 /* size of term */
+		uint16_t space;	 /* number of words of growth space */
+		int64_t	 post;	 /* number of postings for this entry */
 } ENTRY;
 
 typedef struct {
-		long lineoffset;	 /* source line database offset */
-		long fcnoffset;		 /* function name database offset */
-		long fileindex : 24; /* source file name index */
-		long type	   : 8;	 /* reference type (mark character) */
+		int64_t lineoffset; /* source line database offset */
+		int64_t fcnoffset;	/* function name database offset */
+		int32_t fileindex;	/* source file name index */
+		int32_t type;		/* reference type (mark character) */
 } POSTING;
 
+typedef struct {					 /* sorted posting input to invmake() */
+		const char *term;			 /* indexed term */
+		long		lineoffset;		 /* source line database offset */
+		long		fcnoffset;		 /* function name database offset */
+		int			type;			 /* reference type (mark character) */
+} TERMPOSTING;
+
 extern long *srcoffset;	 /* source file name database offsets */
 extern int	 nsrcoffset; /* number of file name database offsets */
 
@@ -106,9 +116,16 @@ POSTING *boolfile(INVCONTROL *invcntl, long *num, int boolarg);
 void	 invclose(INVCONTROL *invcntl);
 void	 invdump(INVCONTROL *invcntl, char *term);
 long	 invfind(INVCONTROL *invcntl, char *searchterm);
+long	 invfoldfind(INVCONTROL *invcntl, char *searchterm);
+int		 invfoldforward(INVCONTROL *invcntl);
+long	 invfoldterm(INVCONTROL *invcntl, char *term);
 int		 invforward(INVCONTROL *invcntl);
+long	 invgramfind(INVCONTROL *invcntl, char **literal, int n);
+int		 invgramforward(INVCONTROL *invcntl);
+long	 invgramterm(INVCONTROL *invcntl, char *term);
 int		 invopen(INVCONTROL *invcntl, char *invname, char *invpost, int status);
-long	 invmake(char *invname, char *invpost, FILE *infile);
+long	 invpostings(INVCONTROL *invcntl, POSTING *postings);
+long	 invmake(char *invname, char *invpost, const TERMPOSTING *(*getposting)(void));
 long	 invterm(INVCONTROL *invcntl, char *term);
 
 #endif /* CSCOPE_INVLIB_H */
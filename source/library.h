@@ -37,6 +37,7 @@
 
 /* private library */
 char	   *compress_path(const char *pathname_);
+char	   *compress_path_in_place(char *pathname);
 char	   *egrepinit(const char *egreppat);
 char	   *logdir(char *name);
 const char *basename(const char *path);
@@ -42,6 +42,9 @@
 #include "vpath.h"
 #include "version.inc"
 #include "scanner.h"
+#include "watch.h"
+#include "buildstats.h"
+#include "digraph.h"
 
 #include <stdlib.h>	   /* atoi */
 #include <ncurses.h>
@@ -50,14 +53,6 @@
 #include <signal.h>
 #include <getopt.h>
 
-/* note: these digraph character frequencies were calculated from possible
-   printable digraphs in the cross-reference for the C compiler */
-char dichar1[] = " teisaprnl(of)=c";	/* 16 most frequent first chars */
-char dichar2[] = " tnerpla";			/* 8 most frequent second chars
-						   using the above as first chars */
-char dicode1[256];						/* digraph first character code */
-char dicode2[256];						/* digraph second character code */
-
 bool  compress = true;			/* compress the characters in the crossref */
 bool  dbtruncated;				/* database symbols are truncated to 8 chars */
 int	  dispcomponents = 1;		/* file path components to display */
@@ -77,7 +72,6 @@ static char path[PATHLEN + 1];	/* file path */
 
 /* Internal prototypes: */
 static void		   skiplist(FILE *oldrefs);
-static void		   initcompress(void);
 static inline void linemode_event_loop(void);
 static inline void screenmode_event_loop(void);
 
@@ -115,19 +109,6 @@ void cannotwrite(const char * const file) {
     postfatal("Removed file %s because write failed", file);
 }
 
-/* set up the digraph character tables for text compression */
-static
-void initcompress(void) {
-	if (compress == true) {
-		for (int i = 0; i < 16; i++) {
-			dicode1[(unsigned char)(dichar1[i])] = i * 8 + 1;
-		}
-		for (int i = 0; i < 8; i++) {
-			dicode2[(unsigned char)(dichar2[i])] = i + 1;
-		}
-	}
-}
-
 /* skip the list in the cross-reference file */
 static
 void skiplist(FILE *oldrefs) {
@@ -299,7 +280,7 @@ void read_old_reffile(const char * reffile) {
 	char * s;
 	FILE * names;	  /* name file pointer */
 	int	oldnum;  /* number in old cross-ref */
-	FILE * oldrefs = vpfopen(reffile, "rb"); /* old cross-reference file */
+	FILE * oldrefs = dbzfopen(reffile); /* old cross-reference file */
 	if (!oldrefs) {
 		postfatal(PROGRAM_NAME ": cannot open file %s\n", reffile);
 	}
@@ -313,6 +294,7 @@ void read_old_reffile(const char * reffile) {
 		/* override these command line options */
 		compress	  = true;
 		invertedindex = false;
+		defaultdigraphs();
 
 		/* see if there are options in the database */
 		for (int c;;) {
@@ -333,6 +315,11 @@ void read_old_reffile(const char * reffile) {
 					dbtruncated = true;
 					trun_syms	= true;
 					break;
+				case 'D': /* digraph table */
+					if (readdigraphs(oldrefs) == false) {
+						postfatal(PROGRAM_NAME ": cannot read digraph table from file %s\n", reffile);
+					}
+					break;
 			}
 		}
 		initcompress();
@@ -462,9 +449,13 @@ int main(const int argc, const char * const * const argv) {
 	if (preserve_database == true) {
         read_old_reffile(reffile);
 	} else {
+		stattime_t start;
+
 		/* make the source file list */
+		stats_begin(&start);
 		srcfiles = malloc(msrcfiles * sizeof(*srcfiles));
 		makefilelist(fileargv);
+		stats_end(PHASE_DISCOVERY, &start);
 		if (nsrcfiles == 0) {
 			postfatal(PROGRAM_NAME ": no source files found\n");
 		}
@@ -482,7 +473,6 @@ int main(const int argc, const char * const * const argv) {
 		setup_build_filenames(reffile);
 
 		/* build the cross-reference */
-		initcompress();
 		if (linemode == false
         || verbosemode == true) { /* display if verbose as well */
 			postmsg("Building cross-reference...");
@@ -490,6 +480,7 @@ int main(const int argc, const char * const * const argv) {
 		build();
 		if (linemode == false) { postmsg(""); /* clear any build progress message */ }
 		if (buildonly == true) {
+			if (watchmode == true) { watch(fileargv); }
 			myexit(0);
 		}
 	}
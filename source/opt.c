@@ -5,6 +5,9 @@
 #include "version.inc"
 #include "auto_vararg.h"
 #include "help.h"
+#include "postsort.h"
+#include "watch.h"
+#include "buildstats.h"
 
 #include <stdlib.h>	 /* atoi */
 #include <getopt.h>
@@ -16,6 +19,15 @@
 #define DEFAULT_LINEFLAG "+%s" /* default: used by vi and emacs */
 #define DEFAULT_TMPDIR	 "/tmp"
 
+/* long options without a short equivalent */
+enum {
+	OPT_SORT_MEMORY = 256,
+	OPT_WATCH,
+	OPT_INCLUDE_CACHE,
+	OPT_BUILD_STATS,
+	OPT_BLOCK_COMPRESS,
+};
+
 /* environment variable holders */
 char * editor;
 char * home;
@@ -99,11 +111,16 @@ char * * parse_options(const int argc, const char * const * const argv) {
 	struct option lopts[] = {
 		{"help",    0, NULL, 'h'},
 		{"version", 0, NULL, 'V'},
+		{"sort-memory", 1, NULL, OPT_SORT_MEMORY},
+		{"watch",       0, NULL, OPT_WATCH},
+		{"include-cache", 0, NULL, OPT_INCLUDE_CACHE},
+		{"build-stats", 0, NULL, OPT_BUILD_STATS},
+		{"block-compress", 0, NULL, OPT_BLOCK_COMPRESS},
 		{0,         0,    0,  0 },
 	};
 
 	while((opt = getopt_long(argc, (char**)argv,
-			   "hVbcCdeF:f:I:i:kLl0:1:2:3:4:5:6:7:8:9:P:p:qRs:TUuvX",
+			   "hVbcCdeF:f:I:i:j:kLl0:1:2:3:4:5:6:7:8:9:P:p:qRs:TUuvX",
 			   lopts,
 			   &longind)) != -1) {
 		switch(opt) {
@@ -150,6 +167,34 @@ char * * parse_options(const int argc, const char * const * const argv) {
 			case 'e': /* suppress ^E prompt between files */
 				editallprompt = false;
 				break;
+			case 'j': /* parallel cross-reference jobs */
+				buildjobs = atoi(optarg);
+				if(buildjobs < 1) {
+					postfatal(PROGRAM_NAME ": -j option: invalid number of jobs %s\n", optarg);
+					/* NOTREACHED */
+				}
+				break;
+			case OPT_SORT_MEMORY: /* inverted index postings sort memory */
+				sortmemory = atol(optarg);
+				if(sortmemory < 1) {
+					postfatal(PROGRAM_NAME ": --sort-memory option: invalid size %s\n", optarg);
+					/* NOTREACHED */
+				}
+				break;
+			case OPT_WATCH: /* keep the cross-reference current */
+				watchmode = true;
+				buildonly = true;
+				linemode  = true;
+				break;
+			case OPT_INCLUDE_CACHE: /* keep the #include cache in the database */
+				includecache = true;
+				break;
+			case OPT_BUILD_STATS: /* report build phase times */
+				buildstats = true;
+				break;
+			case OPT_BLOCK_COMPRESS: /* write a block-compressed database */
+				blockcompress = true;
+				break;
 			case 'k': /* ignore DEFAULT_INCLUDE_DIRECTORY */
 				kernelmode = true;
 				break;
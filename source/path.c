@@ -122,18 +122,19 @@ void path_remove_parent_directory_references(char *path) {
  *    Whenever possible, strings of "/.." are removed together with
  *    the directory names that they follow.
  *
- *    WARNING: since pathname is altered by this function, it should
- *         be located in a temporary buffer. This avoids the problem
- *         of accidently changing strings obtained from makefiles
- *         and stored in global structures.
+ *    compress_path() returns a compressed copy of pathname.
+ *    compress_path_in_place() alters pathname itself, which should
+ *    be located in a temporary buffer.
  */
 char *compress_path(const char *pathname_) {
 	if (pathname_ == NULL) {
 		return NULL;
 	}
 
-	char *pathname = strdup(pathname_);
+	return compress_path_in_place(strdup(pathname_));
+}
 
+char *compress_path_in_place(char *pathname) {
 	/*
 	 *	do not change the path if it has no "/"
 	 */
@@ -0,0 +1,494 @@
+#include "global.h"
+#include "postsort.h"
+
+#include <pthread.h>
+
+/* The postings are kept in memory as fixed size binary records
+ *  that refer to their term by number, and sorted there
+ *  in the order "LC_ALL=C sort" gave the old text postings.
+ * Once they and the terms outgrow the memory budget,
+ *  the sorted postings are spilled to a run file
+ *  and all runs are merged when the index is made.
+ * The terms themselves stay in memory until the index is made.
+ * A posting that there is no memory for fails the sort,
+ *  which postsort_sort() reports.
+ * Postings that are already in order, like those reused from
+ *  the old index, can be merged in as they are.
+ */
+
+#define TEXTINC		(1024 * 1024) /* term text space increment */
+#define POSTINGINC	65536		  /* posting list size increment */
+#define TERMINC		4096		  /* term list size increment */
+#define MINPARALLEL 10000		  /* sort fewer postings in a single thread */
+
+long sortmemory = SORTMEMORY;
+
+typedef struct {		 /* posting as sorted and spilled */
+	long		  lineoffset;
+	long		  fcnoffset;
+	unsigned	  term;	 /* term number */
+	unsigned char type;
+} postrec_t;
+
+typedef struct {		 /* sorted postings being merged */
+	postrec_t *posting;	 /* current posting, NULL once exhausted */
+	postrec_t *next;	 /* postings in memory */
+	postrec_t *end;
+	FILE	  *run;		 /* ... or in a run file */
+	postrec_t  buf;		 /* posting read from the run */
+} source_t;
+
+typedef struct {		 /* part of the postings sorted by one thread */
+	postrec_t *base;
+	size_t	   n;
+} range_t;
+
+static char		  *runprefix;	  /* run file name prefix */
+static int		   nthreads;	  /* sorting threads */
+static int		   nruns;		  /* spilled run files */
+static postrec_t  *postings;	  /* postings held in memory */
+static size_t	   npostings_mem; /* number of them */
+static size_t	   mpostings_mem; /* room for them */
+static char		 **terms;		  /* terms by number */
+static unsigned	   nterms;
+static unsigned	   mterms;
+static unsigned	  *termslots;	  /* term numbers + 1, by hash */
+static unsigned	   nslots;		  /* a power of 2 */
+static char		 **texts;		  /* term text blocks */
+static size_t	   ntexts;
+static char		  *textnext;	  /* free space in the last block */
+static size_t	   textleft;
+static range_t	  *ranges;		  /* sorted parts of the postings */
+static int		   nranges;
+static source_t	  *sources;		  /* merge sources */
+static int		   nrunsources;	  /* open run files, after the ranges */
+static source_t	 **heap;		  /* merge sources by current posting */
+static int		   nheap;
+static TERMPOSTING termposting;	  /* the posting returned by postsort_next() */
+static const TERMPOSTING *(*presorted)(void); /* postings already in order */
+static const TERMPOSTING *presortedposting;	  /* the next of them */
+static bool				  presortedtaken;	  /* it was returned */
+static bool				  nomemory;			  /* a posting was lost */
+
+static int		compare_postings(const postrec_t *p1, const postrec_t *p2);
+static unsigned termhash(const char *term, size_t length);
+static bool		termnumber(const char *term, size_t length, unsigned *number);
+static bool		grow_slots(void);
+static size_t	term_memory(void);
+static void		run_name(char *path, size_t size, int run);
+static bool		sort_postings(void);
+static bool		grow_sources(int n);
+static void		spill(void);
+static void		free_terms(void);
+static void		advance(source_t *source);
+static void		sift_down(int i);
+static void		merge_advance(void);
+
+/* posting order: term, line offset, type and then function offset */
+static
+int compare_postings(const postrec_t *p1, const postrec_t *p2) {
+	int n;
+
+	if(p1->term != p2->term) {
+		n = strcmp(terms[p1->term], terms[p2->term]);
+		if(n != 0) { return n; }
+	}
+	if(p1->lineoffset != p2->lineoffset) { return (p1->lineoffset < p2->lineoffset) ? -1 : 1; }
+	if(p1->type != p2->type) { return p1->type - p2->type; }
+	if(p1->fcnoffset != p2->fcnoffset) { return (p1->fcnoffset < p2->fcnoffset) ? -1 : 1; }
+	return 0;
+}
+
+/* compare a posting with one already in order */
+static
+int compare_presorted(const postrec_t *p1, const TERMPOSTING *p2) {
+	int n;
+
+	if((n = strcmp(terms[p1->term], p2->term)) != 0) { return n; }
+	if(p1->lineoffset != p2->lineoffset) { return (p1->lineoffset < p2->lineoffset) ? -1 : 1; }
+	if(p1->type != p2->type) { return p1->type - p2->type; }
+	if(p1->fcnoffset != p2->fcnoffset) { return (p1->fcnoffset < p2->fcnoffset) ? -1 : 1; }
+	return 0;
+}
+
+/* posting comparison function for qsort */
+static
+int qsort_postings(const void *p1, const void *p2) {
+	return compare_postings(p1, p2);
+}
+
+/* FNV-1a hash of a term */
+static
+unsigned termhash(const char *term, size_t length) {
+	unsigned h = 2166136261u;
+
+	for(size_t i = 0; i < length; ++i) {
+		h = (h ^ (unsigned char)term[i]) * 16777619u;
+	}
+	return h;
+}
+
+/* get the number of a term, entering it if it is new;
+ * false if there is no memory for it */
+static
+bool termnumber(const char *term, size_t length, unsigned *number) {
+	unsigned i;
+	char	*s;
+	char   **t;
+
+	for(i = termhash(term, length) & (nslots - 1); termslots[i] != 0; i = (i + 1) & (nslots - 1)) {
+		s = terms[termslots[i] - 1];
+		if(strncmp(s, term, length) == 0 && s[length] == '\0') {
+			*number = termslots[i] - 1;
+			return true;
+		}
+	}
+	/* keep the table at most half full */
+	if(2 * (nterms + 1) > nslots) {
+		if(grow_slots() == false) { return false; }
+		for(i = termhash(term, length) & (nslots - 1); termslots[i] != 0; i = (i + 1) & (nslots - 1)) {
+			;
+		}
+	}
+
+	/* save the new term */
+	if(length + 1 > textleft) {
+		if((t = realloc(texts, (ntexts + 1) * sizeof(*texts))) == NULL) { return false; }
+		texts = t;
+		if((s = malloc(TEXTINC)) == NULL) { return false; }
+		texts[ntexts++] = textnext = s;
+		textleft					   = TEXTINC;
+	}
+	if(nterms == mterms) {
+		if((t = realloc(terms, (mterms + TERMINC) * sizeof(*terms))) == NULL) { return false; }
+		terms = t;
+		mterms += TERMINC;
+	}
+	s = textnext;
+	memcpy(s, term, length);
+	s[length] = '\0';
+	textnext += length + 1;
+	textleft -= length + 1;
+	terms[nterms] = s;
+	termslots[i]  = ++nterms;
+	*number		  = nterms - 1;
+	return true;
+}
+
+/* double the term hash table */
+static
+bool grow_slots(void) {
+	unsigned *slots = calloc(2 * nslots, sizeof(*slots));
+	unsigned  i;
+
+	if(slots == NULL) { return false; }
+	free(termslots);
+	termslots = slots;
+	nslots *= 2;
+	for(unsigned t = 0; t < nterms; ++t) {
+		for(i = termhash(terms[t], strlen(terms[t])) & (nslots - 1); termslots[i] != 0;
+			i = (i + 1) & (nslots - 1)) {
+			;
+		}
+		termslots[i] = t + 1;
+	}
+	return true;
+}
+
+/* memory held by the terms */
+static
+size_t term_memory(void) {
+	return ntexts * TEXTINC + mterms * sizeof(*terms) + nslots * sizeof(*termslots);
+}
+
+static
+void run_name(char *path, size_t size, int run) {
+	snprintf(path, size, "%s%d", runprefix, run);
+}
+
+static
+void *sort_range(void *arg) {
+	range_t *range = arg;
+
+	qsort(range->base, range->n, sizeof(*range->base), qsort_postings);
+	return NULL;
+}
+
+/* sort the postings in memory, in parallel parts to be merged */
+static
+bool sort_postings(void) {
+	pthread_t threads[nthreads];
+	size_t	  part;
+	range_t	 *r;
+
+	nranges = (npostings_mem >= MINPARALLEL) ? nthreads : 1;
+	part	= (npostings_mem + nranges - 1) / nranges;
+	if((r = realloc(ranges, nranges * sizeof(*ranges))) == NULL) { return false; }
+	ranges = r;
+	for(int i = 0; i < nranges; ++i) {
+		size_t first = i * part;
+
+		ranges[i].base = postings + first;
+		ranges[i].n	   = (first >= npostings_mem) ? 0
+					   : (npostings_mem - first < part) ? npostings_mem - first : part;
+	}
+	for(int i = 1; i < nranges; ++i) {
+		if(pthread_create(&threads[i], NULL, sort_range, &ranges[i]) != 0) {
+			sort_range(&ranges[i]);
+			threads[i] = pthread_self();
+		}
+	}
+	sort_range(&ranges[0]);
+	for(int i = 1; i < nranges; ++i) {
+		if(!pthread_equal(threads[i], pthread_self())) { pthread_join(threads[i], NULL); }
+	}
+	return true;
+}
+
+/* make room to merge n sources */
+static
+bool grow_sources(int n) {
+	source_t  *s;
+	source_t **h;
+
+	if((s = realloc(sources, n * sizeof(*sources))) == NULL) { return false; }
+	sources = s;
+	if((h = realloc(heap, n * sizeof(*heap))) == NULL) { return false; }
+	heap = h;
+	return true;
+}
+
+/* free the term table */
+static
+void free_terms(void) {
+	while(ntexts > 0) {
+		free(texts[--ntexts]);
+	}
+	textleft = 0;
+	nterms	 = 0;
+	free(termslots);
+	termslots = NULL;
+	nslots	  = 0;
+}
+
+/* move to the next posting of a source */
+static
+void advance(source_t *source) {
+	if(source->run == NULL) {
+		source->posting = (source->next < source->end) ? source->next++ : NULL;
+	} else if(fread(&source->buf, sizeof(source->buf), 1, source->run) == 1) {
+		source->posting = &source->buf;
+	} else {
+		source->posting = NULL;
+	}
+}
+
+/* restore the heap order below i */
+static
+void sift_down(int i) {
+	for(;;) {
+		int		  least = i;
+		int		  left	= 2 * i + 1;
+		int		  right = left + 1;
+		source_t *t;
+
+		if(left < nheap && compare_postings(heap[left]->posting, heap[least]->posting) < 0) {
+			least = left;
+		}
+		if(right < nheap && compare_postings(heap[right]->posting, heap[least]->posting) < 0) {
+			least = right;
+		}
+		if(least == i) { return; }
+		t			= heap[i];
+		heap[i]		= heap[least];
+		heap[least] = t;
+		i			= least;
+	}
+}
+
+/* move past the least posting being merged */
+static
+void merge_advance(void) {
+	advance(heap[0]);
+	if(heap[0]->posting == NULL) { heap[0] = heap[--nheap]; }
+	sift_down(0);
+}
+
+/* start merging the given sources */
+static
+void start_merge(int n) {
+	nheap = 0;
+	for(int i = 0; i < n; ++i) {
+		advance(&sources[i]);
+		if(sources[i].posting != NULL) { heap[nheap++] = &sources[i]; }
+	}
+	for(int i = nheap / 2 - 1; i >= 0; --i) {
+		sift_down(i);
+	}
+}
+
+/* the sorted parts of the memory postings as merge sources */
+static
+int memory_sources(void) {
+	for(int i = 0; i < nranges; ++i) {
+		sources[i] = (source_t){
+			.next = ranges[i].base,
+			.end  = ranges[i].base + ranges[i].n,
+		};
+	}
+	return nranges;
+}
+
+/* write the postings in memory to a new sorted run */
+static
+void spill(void) {
+	char  path[PATHLEN + 1];
+	FILE *run;
+
+	if(sort_postings() == false || grow_sources(nranges) == false) {
+		nomemory = true;
+		return;
+	}
+	run_name(path, sizeof(path), nruns);
+	if((run = myfopen(path, "wb")) == NULL) {
+		cannotwrite(path);
+		/* NOTREACHED */
+	}
+	start_merge(memory_sources());
+	while(nheap > 0) {
+		if(fwrite(heap[0]->posting, sizeof(*heap[0]->posting), 1, run) != 1) {
+			cannotwrite(path);
+			/* NOTREACHED */
+		}
+		merge_advance();
+	}
+	if(fclose(run) == EOF) {
+		cannotwrite(path);
+		/* NOTREACHED */
+	}
+	++nruns;
+	npostings_mem = 0;
+}
+
+/* prepare for a new set of postings */
+bool postsort_open(const char *prefix, int threads) {
+	free(runprefix);
+	runprefix = strdup(prefix);
+	nthreads  = (threads > 0) ? threads : 1;
+	nruns	  = 0;
+	nomemory  = false;
+	free_terms();
+	nslots	  = TERMINC;
+	termslots = calloc(nslots, sizeof(*termslots));
+	return runprefix != NULL && termslots != NULL;
+}
+
+/* add a posting */
+void postsort_add(const char *term, size_t length, long lineoffset, int type, long fcnoffset) {
+	postrec_t *p;
+
+	if(nomemory == true) { return; }
+	/* make sure there is room for the posting */
+	if(npostings_mem == mpostings_mem) {
+		if((p = realloc(postings, (mpostings_mem + POSTINGINC) * sizeof(*postings))) == NULL) {
+			nomemory = true;
+			return;
+		}
+		postings = p;
+		mpostings_mem += POSTINGINC;
+	}
+	p = &postings[npostings_mem];
+	if(termnumber(term, length, &p->term) == false) {
+		nomemory = true;
+		return;
+	}
+	++npostings_mem;
+	p->lineoffset = lineoffset;
+	p->fcnoffset  = fcnoffset;
+	p->type		  = type;
+
+	/* spill the postings once they and the terms are over budget,
+	 * but not in runs so short that there are too many to merge */
+	if(npostings_mem >= POSTINGINC
+	&& npostings_mem * sizeof(*postings) + term_memory() > (size_t)sortmemory * 1024 * 1024) {
+		spill();
+	}
+}
+
+/* merge in postings that are already in order */
+void postsort_merge(const TERMPOSTING *(*next)(void)) {
+	presorted		 = next;
+	presortedposting = next();
+	presortedtaken	 = false;
+}
+
+/* sort the postings and start merging them with any spilled runs;
+ * false if a posting was lost for lack of memory */
+bool postsort_sort(void) {
+	char path[PATHLEN + 1];
+	int	 n;
+
+	if(nomemory == true || sort_postings() == false || grow_sources(nranges + nruns) == false) {
+		return false;
+	}
+	n = memory_sources();
+	for(nrunsources = 0; nrunsources < nruns; ++nrunsources, ++n) {
+		run_name(path, sizeof(path), nrunsources);
+		sources[n] = (source_t){ .run = myfopen(path, "rb") };
+		if(sources[n].run == NULL) {
+			cannotopen(path);
+			return false;
+		}
+	}
+	start_merge(n);
+	return true;
+}
+
+/* get the next posting in sorted order, NULL after the last one */
+const TERMPOSTING *postsort_next(void) {
+	const postrec_t *p;
+
+	/* take the next posting already in order if it comes first */
+	if(presortedtaken == true) {
+		presortedposting = presorted();
+		presortedtaken	 = false;
+	}
+	if(presortedposting != NULL
+	&& (nheap == 0 || compare_presorted(heap[0]->posting, presortedposting) > 0)) {
+		presortedtaken = true;
+		return presortedposting;
+	}
+	if(nheap == 0) { return NULL; }
+
+	p					   = heap[0]->posting;
+	termposting.term	   = terms[p->term];
+	termposting.lineoffset = p->lineoffset;
+	termposting.fcnoffset  = p->fcnoffset;
+	termposting.type	   = p->type;
+	merge_advance();
+	return &termposting;
+}
+
+/* release the postings and remove the run files */
+void postsort_close(void) {
+	char path[PATHLEN + 1];
+
+	for(int i = nranges; i < nranges + nrunsources; ++i) {
+		fclose(sources[i].run);
+	}
+	nrunsources = 0;
+	for(int i = 0; i < nruns; ++i) {
+		run_name(path, sizeof(path), i);
+		unlink(path);
+	}
+	nruns			 = 0;
+	nheap			 = 0;
+	npostings_mem	 = 0;
+	presorted		 = NULL;
+	presortedposting = NULL;
+	presortedtaken	 = false;
+	free_terms();
+	free(postings);
+	postings	  = NULL;
+	mpostings_mem = 0;
+}
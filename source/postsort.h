@@ -0,0 +1,24 @@
+#ifndef POSTSORT_H
+#define POSTSORT_H
+
+#include "invlib.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* in-process sort of the inverted index postings,
+ *  replacing the pipe to sort(1)
+ */
+
+#define SORTMEMORY 256 /* default memory budget in megabytes */
+
+extern long sortmemory; /* postings held in memory before spilling, in megabytes */
+
+bool			   postsort_open(const char *runprefix, int threads);
+void			   postsort_add(const char *term, size_t length, long lineoffset, int type, long fcnoffset);
+void			   postsort_merge(const TERMPOSTING *(*next)(void));
+bool			   postsort_sort(void);
+const TERMPOSTING *postsort_next(void);
+void			   postsort_close(void);
+
+#endif
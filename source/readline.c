@@ -1,10 +1,14 @@
 #include <stdio.h>
+#include <time.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "global.h"
 #include "build.h"
 #include <ncurses.h>
 
+#define COMPLETIONS	   16 /* most symbol completions offered */
+#define COMPLETIONTIME 30 /* milliseconds allowed to find them */
+
 static int	input_available = 0;
 static int  input_char;
 char		input_line[PATLEN + 1];
@@ -24,6 +28,8 @@ static struct PARTIAL_LINE {
 
 static inline void previous_history_proxy(void);
 static inline void next_history_proxy(void);
+static char	  **symbol_completion(const char *text, int start, int end);
+static void		display_completions(char **matches, int num_matches, int max_length);
 											 		
 
 bool interpret(int c) {
@@ -178,6 +184,144 @@ static inline void next_history_proxy(){
 	}
 }
 
+/* complete a symbol from the terms of the inverted index with the
+ *  text as prefix, the ones with the most references first;
+ *  the sorted terms are walked only until the time allowed is up,
+ *  so a short prefix gets the best of the terms walked by then
+ */
+static char **symbol_completion(const char *text, int start, int end) {
+	struct {
+		char *term;
+		long  count;
+	} best[COMPLETIONS];
+	struct timespec begin, now;
+	char			prefix[TERMMAX];
+	char			term[TERMMAX];
+	char		  **matches;
+	size_t			len	  = strlen(text);
+	int				nbest = 0;
+	bool			folded;
+	long			count;
+
+	UNUSED(start);
+	UNUSED(end);
+	/* other fields keep the file name completion of readline */
+	rl_sort_completion_matches = 1;
+	if(invertedindex == false || field > CALLING || len >= sizeof(prefix)) { return NULL; }
+	rl_attempted_completion_over   = 1;
+	rl_sort_completion_matches	   = 0;
+	rl_completion_append_character = '\0';
+
+	/* a caseless search walks the case-folded terms, if the index has them */
+	strcpy(prefix, text);
+	folded = false;
+	if(caseless == true) {
+		for(char *s = prefix; *s != '\0'; ++s) {
+			*s = tolower((unsigned char)*s);
+		}
+		folded = invfoldfind(&invcontrol, prefix) != -1;
+	}
+	if(folded == false) {
+		strcpy(prefix, text);
+		UNUSED(invfind(&invcontrol, prefix));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for(long walked = 1;; ++walked) {
+		if(folded == true) {
+			/* walked in case-folded order, but offered as they are */
+			count = invfoldterm(&invcontrol, term);
+			if(*term != '\0' && strncmp(term, prefix, len) != 0) { break; }
+			if(count != 0) {
+				count = invterm(&invcontrol, term);
+			} else {
+				*term = '\0';
+			}
+		} else {
+			count = invterm(&invcontrol, term);
+			if(*term != '\0' && strncmp(term, prefix, len) != 0) { break; }
+		}
+		if(*term != '\0') {
+			char *t;
+
+			/* keep the terms with the most postings */
+			if(nbest < COMPLETIONS) {
+				if((best[nbest].term = strdup(term)) != NULL) { best[nbest++].count = count; }
+			} else {
+				int least = 0;
+
+				for(int i = 1; i < nbest; ++i) {
+					if(best[i].count < best[least].count) { least = i; }
+				}
+				if(count > best[least].count && (t = strdup(term)) != NULL) {
+					free(best[least].term);
+					best[least].term  = t;
+					best[least].count = count;
+				}
+			}
+		}
+		if((folded == true ? invfoldforward(&invcontrol) : invforward(&invcontrol)) == 0) { break; }
+		if(walked % 64 == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if((now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000
+				>= COMPLETIONTIME) {
+				break;
+			}
+		}
+	}
+	if(nbest == 0) { return NULL; }
+
+	/* most references first, after the prefix the completions share */
+	for(int i = 1; i < nbest; ++i) {
+		for(int j = i; j > 0 && best[j].count > best[j - 1].count; --j) {
+			char *t = best[j].term;
+
+			count			  = best[j].count;
+			best[j].term	  = best[j - 1].term;
+			best[j].count	  = best[j - 1].count;
+			best[j - 1].term  = t;
+			best[j - 1].count = count;
+		}
+	}
+	matches = calloc(nbest + 2, sizeof(*matches));
+	if(matches == NULL) {
+		for(int i = 0; i < nbest; ++i) {
+			free(best[i].term);
+		}
+		return NULL;
+	}
+	if(nbest == 1) {
+		matches[0] = best[0].term;
+		return matches;
+	}
+	len = strlen(best[0].term);
+	for(int i = 0; i < nbest; ++i) {
+		size_t n = 0;
+
+		/* caseless, the terms may differ in case where they match */
+		while(n < len && (best[i].term[n] == best[0].term[n]
+			|| (caseless == true && tolower((unsigned char)best[i].term[n]) == tolower((unsigned char)best[0].term[n])))) {
+			++n;
+		}
+		len = n;
+		matches[i + 1] = best[i].term;
+	}
+	if((matches[0] = strdup(best[0].term)) != NULL) { matches[0][len] = '\0'; }
+	return matches;
+}
+
+/* show the completions on the second message line, in their order */
+static void display_completions(char **matches, int num_matches, int max_length) {
+	char   msg[MSGLEN + 1];
+	size_t len = 0;
+
+	UNUSED(max_length);
+	*msg = '\0';
+	for(int i = 1; i <= num_matches && len < sizeof(msg); ++i) {
+		len += snprintf(msg + len, sizeof(msg) - len, "%s%s", (i > 1) ? "  " : "", matches[i]);
+	}
+	postmsg2(msg);
+}
+
 void rlinit() {
 	rl_readline_name = PROGRAM_NAME;
 
@@ -192,5 +336,8 @@ void rlinit() {
 	rl_getc_function		= getc_function;
 	rl_input_available_hook = input_available_hook;
 	rl_redisplay_function	= redisplay_function;
+
+	rl_attempted_completion_function	= symbol_completion;
+	rl_completion_display_matches_hook = display_completions;
 	rl_callback_handler_install("", callback_handler);
 }
@@ -70,6 +70,9 @@ extern FILE *yyin;		/* input file descriptor */
 extern FILE *yyout;		/* output file */
 extern int	 myylineno; /* input line number */
 
+extern const char *scanbuffer; /* mapped source file, or NULL to read yyin */
+extern size_t	   scanlength; /* mapped source file length */
+
 extern char	 *my_yytext; /* private copy of input line */
 extern size_t my_yyleng; /* ... and current length of it */
 
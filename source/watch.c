@@ -0,0 +1,242 @@
+#include "global.h"
+#include "build.h"
+#include "library.h"
+#include "watch.h"
+#include "buildstats.h"
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/* The directories of the source files are watched with inotify.
+ * Changes are collected until none have come for WATCHDELAY,
+ *  then the database is brought up to date by an incremental build,
+ *  which only cross-references the files that changed.
+ * The source file list is only made again when a source file
+ *  comes or goes.
+ * The files seen changing are rebuilt even if their time stamps
+ *  are no newer than the database, which another change in the
+ *  same clock tick as the last build can leave them.
+ */
+
+#define WATCHMASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+bool watchmode = false;
+
+static int	  watchfd;	  /* inotify instance */
+static char **watchdirs;  /* watched directories by watch descriptor */
+static int	  mwatchdirs;
+static char **changedfiles; /* source files changed since the last build */
+static unsigned long nchangedfiles, mchangedfiles;
+
+static void add_watch(const char *dir);
+static void add_watch_tree(const char *dir);
+static void watch_srcfiles(void);
+static bool handle_events(bool *relist);
+static void add_changed(char *file);
+static int	changed_compare(const void *s1, const void *s2);
+
+/* watch a directory */
+static
+void add_watch(const char *dir) {
+	int wd;
+
+	if((wd = inotify_add_watch(watchfd, dir, WATCHMASK)) == -1) { return; }
+	if(wd >= mwatchdirs) {
+		int n = mwatchdirs;
+
+		mwatchdirs = wd + 64;
+		watchdirs  = realloc(watchdirs, mwatchdirs * sizeof(*watchdirs));
+		while(n < mwatchdirs) {
+			watchdirs[n++] = NULL;
+		}
+	}
+	/* the same directory gets the same watch descriptor */
+	if(watchdirs[wd] == NULL) { watchdirs[wd] = strdup(dir); }
+}
+
+/* watch a directory and the directories below it */
+static
+void add_watch_tree(const char *dir) {
+	DIR			  *dirfile;
+	struct dirent *entry;
+	struct stat	   file_status;
+	char		   path[PATHLEN + 1];
+	size_t		   dir_len = strlen(dir);
+
+	add_watch(dir);
+	if((dirfile = opendir(dir)) == NULL) { return; }
+	while((entry = readdir(dirfile)) != NULL) {
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) { continue; }
+		/* the path would not fit in the file list */
+		if(dir_len + 1 + strlen(entry->d_name) >= PATHLEN) { continue; }
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if(entry->d_type == DT_DIR
+		|| (entry->d_type == DT_UNKNOWN && lstat(path, &file_status) == 0
+			&& S_ISDIR(file_status.st_mode))) {
+			add_watch_tree(path);
+		}
+	}
+	closedir(dirfile);
+}
+
+/* watch the source directories and the directories of all source files */
+static
+void watch_srcfiles(void) {
+	char  dir[PATHLEN + 1];
+	char *s;
+
+	for(unsigned long i = 0; i < nsrcdirs; ++i) {
+		if(recurse_dir == true) {
+			add_watch_tree(srcdirs[i]);
+		} else {
+			add_watch(srcdirs[i]);
+		}
+	}
+	for(unsigned long i = 0; i < nsrcfiles; ++i) {
+		snprintf(dir, sizeof(dir), "%s", srcfiles[i]);
+		if((s = strrchr(dir, '/')) == NULL) {
+			strcpy(dir, ".");
+		} else if(s == dir) {
+			s[1] = '\0';
+		} else {
+			*s = '\0';
+		}
+		add_watch(dir);
+	}
+}
+
+/* remember a source file that changed, taking the name */
+static
+void add_changed(char *file) {
+	if(nchangedfiles == mchangedfiles) {
+		mchangedfiles = (mchangedfiles == 0) ? 64 : 2 * mchangedfiles;
+		changedfiles  = realloc(changedfiles, mchangedfiles * sizeof(*changedfiles));
+	}
+	changedfiles[nchangedfiles++] = file;
+}
+
+static
+int changed_compare(const void *s1, const void *s2) {
+	return strcmp(*(const char *const *)s1, *(const char *const *)s2);
+}
+
+/* was the source file seen changing since the last build */
+bool watchchanged(const char *file) {
+	return nchangedfiles > 0
+		&& bsearch(&file, changedfiles, nchangedfiles, sizeof(*changedfiles), changed_compare) != NULL;
+}
+
+/* read the pending events, returning whether any may affect the database;
+ * relist is set when a source file came or went */
+static
+bool handle_events(bool *relist) {
+	char					  buf[16 * BUFSIZ] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	ssize_t					  n;
+	bool					  changed = false;
+
+	if((n = read(watchfd, buf, sizeof(buf))) <= 0) { return false; }
+	for(char *p = buf; p < buf + n; p += sizeof(*event) + event->len) {
+		char  path[PATHLEN + 1];
+		char *file;
+
+		event = (const struct inotify_event *)p;
+		if(event->mask & IN_Q_OVERFLOW) {
+			/* events were lost */
+			*relist = true;
+			changed = true;
+			continue;
+		}
+		if(event->wd < 0 || event->wd >= mwatchdirs || watchdirs[event->wd] == NULL) { continue; }
+		if(event->mask & IN_IGNORED) {
+			/* the directory is gone */
+			free(watchdirs[event->wd]);
+			watchdirs[event->wd] = NULL;
+			continue;
+		}
+		if(event->len == 0
+		|| strlen(watchdirs[event->wd]) + 1 + strlen(event->name) >= PATHLEN) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", watchdirs[event->wd], event->name);
+		if(event->mask & IN_ISDIR) {
+			/* a new directory may have source files below it */
+			if(recurse_dir == true && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+				add_watch_tree(path);
+				*relist = true;
+				changed = true;
+			}
+			continue;
+		}
+		file = compress_path(path);
+		if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			if(infilelist(file) == true) {
+				*relist = true;
+				changed = true;
+			}
+		} else if(infilelist(file) == true) {
+			add_changed(file);
+			changed = true;
+			continue;
+		} else if(event->mask & (IN_CREATE | IN_MOVED_TO) && is_source_file(file)) {
+			*relist = true;
+			changed = true;
+		}
+		free(file);
+	}
+	return changed;
+}
+
+/* keep the database current until killed */
+void watch(const char * const *argv) {
+	struct pollfd pfd;
+
+	if((watchfd = inotify_init1(IN_CLOEXEC)) == -1) {
+		myperror(PROGRAM_NAME);
+		postfatal(PROGRAM_NAME ": cannot watch the source files\n");
+		/* NOTREACHED */
+	}
+	watch_srcfiles();
+	pfd.fd	   = watchfd;
+	pfd.events = POLLIN;
+	for(;;) {
+		bool changed = false;
+		bool relist	 = false;
+		int	 timeout = -1;
+
+		/* wait for a change, then until the changes stop */
+		for(int n; (n = poll(&pfd, 1, timeout)) != 0;) {
+			if(n == -1) {
+				if(errno == EINTR) { continue; }
+				myperror(PROGRAM_NAME);
+				postfatal(PROGRAM_NAME ": cannot watch the source files\n");
+				/* NOTREACHED */
+			}
+			if(pfd.revents & POLLIN) {
+				changed |= handle_events(&relist);
+			}
+			if(changed == true) { timeout = WATCHDELAY; }
+		}
+		if(relist == true) {
+			stattime_t start;
+
+			stats_begin(&start);
+			freefilelist();
+			makefilelist(argv);
+			stats_end(PHASE_DISCOVERY, &start);
+			watch_srcfiles();
+		}
+		if(verbosemode == true) {
+			fprintf(stderr, PROGRAM_NAME ": updating %s\n", reffile);
+		}
+		nsrcoffset = 0;
+		npostings  = 0;
+		if(nchangedfiles > 0) { qsort(changedfiles, nchangedfiles, sizeof(*changedfiles), changed_compare); }
+		build();
+		while(nchangedfiles > 0) {
+			free(changedfiles[--nchangedfiles]);
+		}
+	}
+}
@@ -0,0 +1,13 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+#define WATCHDELAY 250 /* milliseconds without changes before rebuilding */
+
+extern bool watchmode; /* keep the database current after building it */
+
+void watch(const char * const *argv);
+bool watchchanged(const char *file);
+
+#endif
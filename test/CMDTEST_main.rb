@@ -36,4 +36,132 @@ class CMDTEST_dummy_project < Cmdtest::Testcase
       stdout_equal /\A.+#{$f_definition_line}.+\n\Z/
     end
   end
+
+  def test_parallel_build
+    cmd "csope -k -b -q -f serial.out -s dummy_project/" do
+      created_files ["serial.out", "serial.out.in", "serial.out.po"]
+    end
+    cmd "csope -k -b -q -j 2 -f par.out -s dummy_project/" do
+      created_files ["par.out", "par.out.in", "par.out.po"]
+    end
+    # the jobs must not change a byte of the database or its index
+    cmd "cmp serial.out par.out && cmp serial.out.in par.out.in && cmp serial.out.po par.out.po" do
+    end
+    cmd "csope -k -d -f par.out -L -1 f" do
+      stdout_equal /\A.+#{$f_definition_line}.+\n\Z/
+    end
+  end
+
+  def test_build_stats
+    cmd "csope -k -b -j 2 --build-stats -s dummy_project/" do
+      created_files ["cscope.out"]
+      stderr_equal /\A\{"files":3,"lexed":3,"copied":0,"bytes_lexed":\d+,"bytes_copied":0,"bytes_written":\d+,.*"phases":\{"discovery":\{"wall":.*"slowest":\[\{"file":"dummy_project\/\w+\.[ch]","seconds":[\d.]+,"bytes":\d+\}.*\]\}\n\z/
+    end
+  end
+
+  def test_incremental_inverted_index
+    cmd "csope -k -b -q -s dummy_project/" do
+      created_files ["cscope.out", "cscope.in.out", "cscope.po.out"]
+    end
+    create_file "dummy_project/g.c", "int g(void) { return 0; }\n"
+    cmd "csope -k -b -q -s dummy_project/" do
+      changed_files ["cscope.out", "cscope.in.out", "cscope.po.out"]
+    end
+    cmd "csope -k -d -q -L -1 f" do
+      stdout_equal /\A.+#{$f_definition_line}.+\n\Z/
+    end
+    cmd "csope -k -d -q -L -1 g" do
+      stdout_equal /\Adummy_project\/g.c .+\n\Z/
+    end
+  end
+
+  def test_touched_file_unchanged
+    cmd "csope -k -b -s dummy_project/" do
+      created_files ["cscope.out"]
+    end
+    cmd "touch -d '+1 hour' dummy_project/main.c" do
+      changed_files ["dummy_project/main.c"]
+    end
+    cmd "csope -k -b -s dummy_project/" do
+    end
+  end
+
+  def test_include_cache
+    cmd "csope -k -b --include-cache -s dummy_project/" do
+      created_files ["cscope.out"]
+    end
+    create_file "dummy_project/g.c", "#include \"h.h\"\nint g(void) { return 0; }\n"
+    cmd "csope -k -b --include-cache -s dummy_project/" do
+      changed_files ["cscope.out"]
+    end
+    cmd "csope -k -d -L -1 g" do
+      stdout_equal /\Adummy_project\/g.c .+\n\Z/
+    end
+  end
+
+  def test_include_cache_new_header
+    create_file "inc/i.h", "int i;\n"
+    create_file "dummy_project/g.c", "#include <new.h>\nint g(void) { return 0; }\n"
+    cmd "csope -k -b --include-cache -I inc -s dummy_project/" do
+      created_files ["cscope.out"]
+    end
+    cmd "csope -k -d -L -7 new.h" do
+      stdout_equal ""
+    end
+    create_file "inc/new.h", "int h(void);\n"
+    create_file "dummy_project/g.c", "#include <new.h>\nint g(void) { return 1; }\n"
+    cmd "csope -k -b --include-cache -I inc -s dummy_project/" do
+      changed_files ["cscope.out"]
+    end
+    cmd "csope -k -d -L -7 new.h" do
+      stdout_equal /\Ainc\/new.h .+\n\Z/
+    end
+  end
+
+  # run a query on databases built with and without an inverted index,
+  #  which must find the same references
+  def query_same_inverted(query)
+    cmd "csope -k -d -f plain.out #{query} > plain.txt && test -s plain.txt && " +
+        "csope -k -d -q -f inverted.out #{query} > inverted.txt && " +
+        "cmp plain.txt inverted.txt && rm plain.txt inverted.txt" do
+    end
+  end
+
+  def test_inverted_index_patterns
+    cmd "csope -k -b -f plain.out -s dummy_project/" do
+      created_files ["plain.out"]
+    end
+    cmd "csope -k -b -q -f inverted.out -s dummy_project/" do
+      created_files ["inverted.out", "inverted.out.in", "inverted.out.po"]
+    end
+    # no prefix, and no trigram either
+    query_same_inverted "-L -0 '.*f'"
+    # no prefix, through the trigram table
+    query_same_inverted "-L -0 '.*ain'"
+    query_same_inverted "-L -0 '(x)?mai.*'"
+    # a short prefix, before an optional group or character
+    query_same_inverted "-L -0 'ma(in)?'"
+    query_same_inverted "-L -0 'mai*n'"
+    # caseless, through the case-folded term table
+    query_same_inverted "-C -L -0 F"
+    query_same_inverted "-C -L -0 'MA.*'"
+  end
+
+  def test_block_compress
+    cmd "csope -k -b -q --block-compress -s dummy_project/" do
+      created_files ["cscope.out", "cscope.in.out", "cscope.po.out"]
+    end
+    cmd "csope -k -d -L -1 f" do
+      stdout_equal /\A.+#{$f_definition_line}.+\n\Z/
+    end
+    cmd "csope -k -d -q -L -0 f" do
+      stdout_equal /\A(.*\n){2}\Z/
+    end
+    cmd "csope -k -b -q -s dummy_project/" do
+      changed_files ["cscope.out", "cscope.in.out", "cscope.po.out"]
+    end
+    cmd "csope -k -d -L -1 f" do
+      stdout_equal /\A.+#{$f_definition_line}.+\n\Z/
+    end
+  end
 end